@@ -0,0 +1,872 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+#include "QuadMesh.h"
+#include "VectorBatch.h"
+#include "TerrainQuery.h"
+#include "FastGauss.h"
+#include "HorizonOcclusion.h"
+#include "SharedTerrain.h"
+#include "TileService.h"
+#include "Benchmarks.h"
+
+#ifdef _MSC_VER
+#define NOINLINE __declspec(noinline)
+#else
+#define NOINLINE __attribute__((noinline))
+#endif
+
+// Out-of-line copies of the original Vector3D.cpp functions, kept as the baseline.
+NOINLINE static float OutOfLineLength(Vector3D* lhs)
+{
+	return (float)sqrt(lhs->x*lhs->x + lhs->y*lhs->y + lhs->z*lhs->z);
+}
+
+NOINLINE static void OutOfLineNormalize(Vector3D* lhs)
+{
+	const float norm = OutOfLineLength(lhs);
+	if (norm > 0)
+	{
+		lhs->x /= norm; lhs->y /= norm; lhs->z /= norm;
+	}
+}
+
+NOINLINE static void OutOfLineCross(const Vector3D* lhs, const Vector3D* rhs, Vector3D* result)
+{
+	Set(result, lhs->y*rhs->z - lhs->z*rhs->y, lhs->z*rhs->x - lhs->x*rhs->z, lhs->x*rhs->y - lhs->y*rhs->x);
+}
+
+// Copy of the original per-quad ComputeNormalsQM, kept as the baseline for the batched
+// one. Every quad adds the normalized corner normals to its four vertices.
+NOINLINE static void PerQuadComputeNormals(QuadMesh* qm)
+{
+	int currentQuad = 0;
+
+	for (int j = 0; j < qm->meshSize; j++)
+	{
+		for (int k = 0; k < qm->meshSize; k++)
+		{
+			MeshVertex** v = qm->quads[currentQuad].vertices;
+			Vector3D n0, n1, n2, n3;
+			Vector3D e0, e1, e2, e3;
+
+			for (int i = 0; i < 4; i++)
+			{
+				LoadZero(&v[i]->normal);
+			}
+
+			Subtract(&v[1]->position, &v[0]->position, &e0);
+			Subtract(&v[2]->position, &v[1]->position, &e1);
+			Subtract(&v[3]->position, &v[2]->position, &e2);
+			Subtract(&v[0]->position, &v[3]->position, &e3);
+			OutOfLineNormalize(&e0);
+			OutOfLineNormalize(&e1);
+			OutOfLineNormalize(&e2);
+			OutOfLineNormalize(&e3);
+
+			Vector3D w;    // Working vector;
+
+			Negate(&e3, &w);
+			OutOfLineCross(&e0, &w, &n0);
+			OutOfLineNormalize(&n0);
+			Add(&v[0]->normal, &n0, &v[0]->normal);
+
+			Negate(&e0, &w);
+			OutOfLineCross(&e1, &w, &n1);
+			OutOfLineNormalize(&n1);
+			Add(&v[1]->normal, &n1, &v[1]->normal);
+
+			Negate(&e1, &w);
+			OutOfLineCross(&e2, &w, &n2);
+			OutOfLineNormalize(&n2);
+			Add(&v[2]->normal, &n2, &v[2]->normal);
+
+			Negate(&e2, &w);
+			OutOfLineCross(&e3, &w, &n3);
+			OutOfLineNormalize(&n3);
+			Add(&v[3]->normal, &n3, &v[3]->normal);
+
+			for (int i = 0; i < 4; i++)
+			{
+				OutOfLineNormalize(&v[i]->normal);
+			}
+
+			currentQuad++;
+		}
+	}
+}
+
+static double NowSeconds()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Runs body() repeatedly for roughly 0.2 s and returns nanoseconds per element.
+template <typename Body>
+static double TimePerElement(int elements, Body body)
+{
+	int reps = 0;
+	double start = NowSeconds(), elapsed = 0;
+	do
+	{
+		body();
+		reps++;
+		elapsed = NowSeconds() - start;
+	} while (elapsed < 0.2);
+	return elapsed * 1e9 / ((double)reps * elements);
+}
+
+static float Checksum(const std::vector<Vector3D>& v)
+{
+	float sum = 0;
+	for (size_t i = 0; i < v.size(); i++)
+		sum += v[i].x + v[i].y + v[i].z;
+	return sum;
+}
+
+// Lays out a meshSize x meshSize grid over extent x extent units of the x/-z quadrant.
+static void InitBenchMesh(QuadMesh* qm, int meshSize, double extent)
+{
+	InitMeshQM(qm, meshSize, NewVector3D(0, 0, 0), extent, extent, NewVector3D(1, 0, 0), NewVector3D(0, 0, -1));
+}
+
+static QuadMesh MakeBenchMesh(int meshSize, double extent)
+{
+	QuadMesh qm = NewQuadMesh(meshSize);
+	InitBenchMesh(&qm, meshSize, extent);
+	return qm;
+}
+
+static void RandomBlobs(std::vector<Metaball>& blobs, int count)
+{
+	blobs.clear();
+	for (int k = 0; k < count; k++)
+	{
+		Metaball blob;
+		blob.pos = NewVector3D((float)(rand() % 32), 0, -(float)(rand() % 32));
+		blob.width = 0.1;
+		blob.height = rand() % 10 - 5;
+		blobs.push_back(blob);
+	}
+}
+
+bool RunVectorBenchmarks()
+{
+	const int n = 1 << 16;
+	std::vector<Vector3D> a(n), b(n), out(n);
+	srand(1);
+	for (int i = 0; i < n; i++)
+	{
+		a[i] = NewVector3D((float)(rand() % 2001 - 1000), (float)(rand() % 2001 - 1000), (float)(rand() % 2001 - 1000));
+		b[i] = NewVector3D((float)(rand() % 2001 - 1000), (float)(rand() % 2001 - 1000), (float)(rand() % 2001 - 1000));
+	}
+
+	printf("Vector operations, ns per vector (%d vectors)\n", n);
+	printf("%-12s %12s %12s %12s\n", "", "out-of-line", "inline", "batched");
+
+	double tOut = TimePerElement(n, [&] { out = a; for (int i = 0; i < n; i++) OutOfLineNormalize(&out[i]); });
+	double tIn = TimePerElement(n, [&] { out = a; for (int i = 0; i < n; i++) Normalize(&out[i]); });
+	double tBatch = TimePerElement(n, [&] { out = a; NormalizeN(out.data(), n); });
+	printf("%-12s %12.2f %12.2f %12.2f\n", "normalize", tOut, tIn, tBatch);
+
+	tOut = TimePerElement(n, [&] { for (int i = 0; i < n; i++) OutOfLineCross(&a[i], &b[i], &out[i]); });
+	tIn = TimePerElement(n, [&] { for (int i = 0; i < n; i++) CrossProduct(&a[i], &b[i], &out[i]); });
+	tBatch = TimePerElement(n, [&] { CrossProductN(a.data(), b.data(), out.data(), n); });
+	printf("%-12s %12.2f %12.2f %12.2f\n", "cross", tOut, tIn, tBatch);
+
+	// The batched kernels must match the scalar functions exactly
+	bool ok = true;
+	std::vector<Vector3D> scalar(n);
+	CrossProductN(a.data(), b.data(), out.data(), n);
+	NormalizeN(out.data(), n);
+	for (int i = 0; i < n; i++)
+	{
+		CrossProduct(&a[i], &b[i], &scalar[i]);
+		Normalize(&scalar[i]);
+		ok = ok && scalar[i].x == out[i].x && scalar[i].y == out[i].y && scalar[i].z == out[i].z;
+	}
+
+	const int meshSize = 512;
+	QuadMesh qm = MakeBenchMesh(meshSize, 32);
+	std::vector<Metaball> blobs;
+	RandomBlobs(blobs, 16);
+	UpdateMesh(&qm, blobs);
+	double tPerQuad = TimePerElement(qm.numVertices, [&] { PerQuadComputeNormals(&qm); });
+	double tNormals = TimePerElement(qm.numVertices, [&] { ComputeNormalsQM(&qm); });
+	printf("normals (%dx%d), ns per vertex: per-quad %.2f, batched %.2f (%.1fx)\n",
+		meshSize, meshSize, tPerQuad, tNormals, tPerQuad / tNormals);
+	FreeMemoryQM(&qm);
+
+	printf("batched results %s scalar results (checksum %g)\n", ok ? "match" : "DO NOT match", Checksum(out));
+	return ok;
+}
+
+// True if every vertex whose height differs from before lies inside rect; before is then
+// brought up to date
+static bool RectCoversChanges(const QuadMesh* qm, std::vector<float>& before, const MeshRect& rect)
+{
+	bool ok = true;
+	int rowLen = qm->meshSize + 1;
+	for (int i = 0; i < qm->numVertices; i++)
+	{
+		int r = i / rowLen, c = i % rowLen;
+		if (qm->vertices[i].position.y != before[i] && (c < rect.c0 || c > rect.c1 || r < rect.r0 || r > rect.r1))
+			ok = false;
+		before[i] = qm->vertices[i].position.y;
+	}
+	return ok;
+}
+
+// True if both meshes hold exactly the same heights
+static bool SameHeights(const QuadMesh* a, const QuadMesh* b)
+{
+	for (int i = 0; i < a->numVertices; i++)
+		if (a->vertices[i].position.y != b->vertices[i].position.y)
+			return false;
+	return true;
+}
+
+bool RunProgressiveBenchmarks()
+{
+	const int meshSize = 512;
+	const double budgetMs = 2;
+	QuadMesh exact = MakeBenchMesh(meshSize, 32), progressive = MakeBenchMesh(meshSize, 32);
+	std::vector<Metaball> blobs;
+	srand(7);
+	RandomBlobs(blobs, 64);
+	std::vector<float> before(progressive.numVertices, 0.0f);
+
+	printf("Progressive refinement vs exact UpdateMesh (%dx%d mesh, %.0f ms budget)\n", meshSize, meshSize, budgetMs);
+
+	// Full evaluation from scratch
+	double start = NowSeconds();
+	UpdateMesh(&exact, blobs);
+	double exactMs = (NowSeconds() - start) * 1e3;
+	MeshRect changed = EmptyRectQM();
+	start = NowSeconds();
+	BeginProgressiveQM(&progressive, blobs, budgetMs, &changed);
+	double previewMs = (NowSeconds() - start) * 1e3;
+	int steps = 0;
+	while (!RefineMeshQM(&progressive, blobs, budgetMs, &changed))
+		steps++;
+	double refinedMs = (NowSeconds() - start) * 1e3;
+	bool fullOk = SameHeights(&exact, &progressive) && RectCoversChanges(&progressive, before, changed);
+	printf("full:   exact %.1f ms, preview %.1f ms, refined in %d steps / %.1f ms, %s\n",
+		exactMs, previewMs, steps, refinedMs, fullOk ? "exact" : "DIFFERENT");
+
+	// A narrow blob moves: only the cells around it are refreshed, and refining may be cut
+	// short by further moves before it converges
+	bool partialOk = true;
+	double refreshed = 0;
+	steps = 0;
+	blobs[0].width = 4;
+	blobs[0].pos = NewVector3D(8, 0, -8);
+	start = NowSeconds();
+	for (int move = 0; move < 8; move++)
+	{
+		blobs[0].pos.x += 0.75f;
+		blobs[0].pos.z -= 0.5f;
+		changed = EmptyRectQM();
+		BeginProgressiveQM(&progressive, blobs, budgetMs, &changed);
+		refreshed += changed.c1 < changed.c0 ? 0 : (double)(changed.c1 - changed.c0 + 1) * (changed.r1 - changed.r0 + 1) / progressive.numVertices / 8;
+		if (move % 2 == 0 && !RefineMeshQM(&progressive, blobs, budgetMs / 4, &changed))
+			steps++;
+		partialOk = partialOk && RectCoversChanges(&progressive, before, changed);
+	}
+	changed = EmptyRectQM();
+	while (!RefineMeshQM(&progressive, blobs, budgetMs, &changed))
+		steps++;
+	refinedMs = (NowSeconds() - start) * 1e3;
+	partialOk = partialOk && RectCoversChanges(&progressive, before, changed);
+	UpdateMesh(&exact, blobs);
+	partialOk = partialOk && SameHeights(&exact, &progressive);
+	printf("moved:  8 moves refreshing %.1f%% of the mesh each, refined in %d steps / %.1f ms, %s\n",
+		refreshed * 100, steps, refinedMs, partialOk ? "exact" : "DIFFERENT");
+
+	FreeMemoryQM(&exact);
+	FreeMemoryQM(&progressive);
+	printf("progressive results %s UpdateMesh, changed rects %s\n", fullOk && partialOk ? "match" : "DO NOT match",
+		fullOk && partialOk ? "cover every change" : "may miss changes");
+	return fullOk && partialOk;
+}
+
+bool RunQueryBenchmarks()
+{
+	const int meshSize = 512;
+	const int n = 1 << 20;
+	QuadMesh qm = MakeBenchMesh(meshSize, 32);
+	std::vector<Metaball> blobs;
+	srand(2);
+	RandomBlobs(blobs, 16);
+	UpdateMesh(&qm, blobs);
+	PublishTerrainQM(&qm, blobs);
+
+	// 1 in 16 points lies outside the 32x32 grid
+	std::vector<float> x(n), z(n), heights(n);
+	std::vector<Vector3D> normals(n);
+	for (int i = 0; i < n; i++)
+	{
+		bool off = (i & 15) == 0;
+		x[i] = (float)rand() / RAND_MAX * 32 + (off ? 40 : 0);
+		z[i] = -(float)rand() / RAND_MAX * 32;
+	}
+
+	printf("Terrain queries on a %dx%d grid (%d points)\n", meshSize, meshSize, n);
+	TerrainSnapshotRef snapshot = AcquireTerrainSnapshot();
+	const char* names[2] = { "bilinear", "bicubic" };
+	const TerrainFilter filters[2] = { TERRAIN_BILINEAR, TERRAIN_BICUBIC };
+	for (int f = 0; f < 2; f++)
+	{
+		double ns = TimePerElement(n, [&] { QueryTerrain(snapshot.get(), x.data(), z.data(), n, filters[f], heights.data(), normals.data()); });
+		double maxError = 0;
+		for (int i = 0; i < n; i += 97)
+		{
+			double error = fabs(heights[i] - EvaluateHeightQM(blobs, x[i], z[i]));
+			maxError = error > maxError ? error : maxError;
+		}
+		printf("%-10s %8.1f M queries/sec, max height error vs field %.5f\n", names[f], 1e3 / ns, maxError);
+	}
+
+	// Batches may take the AVX2 kernel, single points never do; both must agree
+	bool batchOk = true;
+	QueryTerrain(snapshot.get(), x.data(), z.data(), n, TERRAIN_BILINEAR, heights.data(), normals.data());
+	for (int i = 0; i < n; i += 13)
+	{
+		float h;
+		Vector3D normal;
+		QueryTerrain(snapshot.get(), &x[i], &z[i], 1, TERRAIN_BILINEAR, &h, &normal);
+		batchOk = batchOk && fabs(h - heights[i]) <= 1e-5f * (1 + fabs(h))
+			&& fabs(normal.x - normals[i].x) + fabs(normal.y - normals[i].y) + fabs(normal.z - normals[i].z) <= 1e-5f;
+	}
+	printf("batched bilinear queries %s single queries\n", batchOk ? "match" : "DO NOT match");
+
+	// Readers keep querying while the mesh is re-evaluated and republished
+	std::atomic<bool> stop(false);
+	std::atomic<bool> ok(true);
+	std::atomic<long long> queries(0);
+	std::vector<std::thread> readers;
+	int readerCount = (int)std::thread::hardware_concurrency() > 1 ? (int)std::thread::hardware_concurrency() - 1 : 1;
+	for (int r = 0; r < readerCount; r++)
+	{
+		readers.push_back(std::thread([&, r] {
+			const int batch = 4096;
+			std::vector<float> h(batch);
+			std::vector<Vector3D> nn(batch);
+			unsigned long long lastSeen = 0;
+			while (!stop)
+			{
+				TerrainSnapshotRef s = AcquireTerrainSnapshot();
+				if (s->epoch < lastSeen)
+					ok = false;
+				lastSeen = s->epoch;
+				int start = (r * batch) % (n - batch);
+				QueryTerrain(s.get(), &x[start], &z[start], batch, TERRAIN_BILINEAR, h.data(), nn.data());
+				for (int i = 0; i < batch; i++)
+					if (!(h[i] == h[i]) || !(nn[i].y > 0))
+						ok = false;
+				queries += batch;
+			}
+		}));
+	}
+
+	int publications = 0;
+	double start = NowSeconds();
+	while (NowSeconds() - start < 1.0)
+	{
+		blobs[publications % blobs.size()].pos.x = (float)(rand() % 32);
+		UpdateMesh(&qm, blobs);
+		PublishTerrainQM(&qm, blobs);
+		publications++;
+	}
+	stop = true;
+	for (size_t r = 0; r < readers.size(); r++)
+		readers[r].join();
+	printf("concurrent: %d publications, %lld queries from %d threads, %s\n",
+		publications, queries.load(), readerCount, ok ? "consistent" : "INCONSISTENT");
+
+	FreeMemoryQM(&qm);
+	return ok && batchOk;
+}
+
+bool RunFGTBenchmarks()
+{
+	const int meshSize = 256;
+	const int blobCounts[3] = { 256, 1024, 4096 };
+	const double tolerances[2] = { 1e-2, 1e-4 };
+	QuadMesh exact = MakeBenchMesh(meshSize, 32), fast = MakeBenchMesh(meshSize, 32);
+
+	printf("Fast Gauss Transform vs exact UpdateMesh (%dx%d mesh)\n", meshSize, meshSize);
+	printf("%6s %6s %9s %10s %10s %8s %11s %11s %s\n", "blobs", "wide", "tolerance", "exact ms", "fgt ms", "speedup", "max error", "rms error", "clusters/order/direct");
+
+	bool ok = true;
+	srand(3);
+	for (int n = 0; n < 3; n++)
+	{
+		for (int mix = 0; mix < 2; mix++)
+		{
+			// Wide overlapping blobs, optionally with a quarter of narrow ones mixed in
+			std::vector<Metaball> blobs;
+			for (int k = 0; k < blobCounts[n]; k++)
+			{
+				Metaball blob;
+				blob.pos = NewVector3D((float)rand() / RAND_MAX * 40 - 4, 0, -(float)rand() / RAND_MAX * 40 + 4);
+				blob.width = (mix == 1 && k % 4 == 0) ? 2.0 : 0.02;
+				blob.height = (double)rand() / RAND_MAX * 2 - 1;
+				blobs.push_back(blob);
+			}
+
+			double start = NowSeconds();
+			UpdateMesh(&exact, blobs);
+			double exactMs = (NowSeconds() - start) * 1e3;
+
+			for (int t = 0; t < 2; t++)
+			{
+				FGTReport report;
+				start = NowSeconds();
+				UpdateMeshFGT(&fast, blobs, tolerances[t], &report);
+				double fastMs = (NowSeconds() - start) * 1e3;
+
+				double maxError = 0, sumSq = 0, maxHeight = 0;
+				for (int i = 0; i < exact.numVertices; i++)
+				{
+					double error = fabs(exact.vertices[i].position.y - fast.vertices[i].position.y);
+					maxError = error > maxError ? error : maxError;
+					maxHeight = fabs(exact.vertices[i].position.y) > maxHeight ? fabs(exact.vertices[i].position.y) : maxHeight;
+					sumSq += error * error;
+				}
+				// Allow for the float rounding of both paths on top of the tolerance
+				ok = ok && maxError <= tolerances[t] + 8 * FLT_EPSILON * maxHeight;
+				printf("%6d %6s %9.0e %10.1f %10.1f %7.1fx %11.2e %11.2e %d/%d/%d\n", blobCounts[n], mix ? "75%" : "100%",
+					tolerances[t], exactMs, fastMs, exactMs / fastMs, maxError, sqrt(sumSq / exact.numVertices),
+					report.clusters, report.maxOrder, report.exactBlobs);
+			}
+		}
+	}
+
+	FreeMemoryQM(&exact);
+	FreeMemoryQM(&fast);
+	printf("errors %s the tolerance\n", ok ? "within" : "EXCEED");
+	return ok;
+}
+
+// Horizon of vertex (r, c) in grid direction (dc, dr) by marching every step to the border.
+static float MarchedHorizon(const QuadMesh* qm, int r, int c, int dc, int dr)
+{
+	const int last = qm->meshSize;
+	const Vector3D& p = qm->vertices[r * (last + 1) + c].position;
+	float best = 0;
+	for (int k = 1; r + k * dr >= 0 && r + k * dr <= last && c + k * dc >= 0 && c + k * dc <= last; k++)
+	{
+		const Vector3D& q = qm->vertices[(r + k * dr) * (last + 1) + c + k * dc].position;
+		float slope = (q.y - p.y) / sqrtf((q.x - p.x) * (q.x - p.x) + (q.z - p.z) * (q.z - p.z));
+		best = slope > best ? slope : best;
+	}
+	return atanf(best);
+}
+
+bool RunOcclusionBenchmarks()
+{
+	const int meshSizes[2] = { 256, 1024 };
+	const int dirCol[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+	const int dirRow[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+	const float step = 1.5707963f / 255;   // one quantization step of the stored horizons
+	const Vector3D sun = NewVector3D(84, 100, 16);
+
+	printf("Horizon occlusion (%u hardware threads)\n", std::thread::hardware_concurrency());
+	printf("%6s %10s %10s %10s %12s %14s %s\n", "mesh", "full ms", "edit ms", "march ms", "marched/vtx", "horizon err", "partial vs full");
+
+	bool ok = true;
+	srand(4);
+	std::vector<Metaball> blobs;
+	RandomBlobs(blobs, 64);
+	for (int m = 0; m < 2; m++)
+	{
+		const int meshSize = meshSizes[m];
+		QuadMesh edited = MakeBenchMesh(meshSize, 32), fresh = MakeBenchMesh(meshSize, 32);
+
+		std::vector<Metaball> scene = blobs;
+		UpdateMesh(&edited, scene);
+		double start = NowSeconds();
+		UpdateOcclusionQM(&edited, sun);
+		double fullMs = (NowSeconds() - start) * 1e3;
+
+		// Ray-march a sample of the vertices as the reference
+		int samples = 0;
+		float maxError = 0;
+		start = NowSeconds();
+		for (int r = 0; r <= meshSize; r += 7)
+		{
+			for (int c = 0; c <= meshSize; c += 5, samples++)
+			{
+				for (int d = 0; d < 8; d++)
+				{
+					float marched = MarchedHorizon(&edited, r, c, dirCol[d], dirRow[d]);
+					float error = fabsf(edited.horizons[(r * (meshSize + 1) + c) * 8 + d] * step - marched);
+					maxError = error > maxError ? error : maxError;
+				}
+			}
+		}
+		double marchMs = (NowSeconds() - start) * 1e3;
+		ok = ok && maxError <= step;
+
+		// A narrow blob added in one corner should only redo the lines through it
+		Metaball blob;
+		blob.pos = NewVector3D(8, 0, -8);
+		blob.width = 2.0;
+		blob.height = 3.0;
+		scene.push_back(blob);
+		UpdateMesh(&edited, scene);
+		start = NowSeconds();
+		UpdateOcclusionQM(&edited, sun);
+		double editMs = (NowSeconds() - start) * 1e3;
+
+		UpdateMesh(&fresh, scene);
+		UpdateOcclusionQM(&fresh, sun);
+		float maxDiff = 0;
+		for (int i = 0; i < fresh.numVertices; i++)
+		{
+			float diff = fabsf(edited.vertices[i].occlusion - fresh.vertices[i].occlusion);
+			maxDiff = diff > maxDiff ? diff : maxDiff;
+		}
+		ok = ok && maxDiff < 0.01f;
+
+		printf("%6d %10.2f %10.2f %10.2f %12.4f %13.2e %15.2e\n", meshSize, fullMs, editMs, marchMs,
+			marchMs / samples, maxError, maxDiff);
+		FreeMemoryQM(&edited);
+		FreeMemoryQM(&fresh);
+	}
+	printf("horizons %s ray marching\n", ok ? "match" : "DIFFER FROM");
+	return ok;
+}
+
+#ifndef _WIN32
+
+typedef struct SharedReadStats
+{
+	long long views;          // consistent views checked
+	long long retries;        // views overwritten while being read
+	long long bad;            // consistent views whose contents were wrong
+	long long stale;          // views older than the previous one seen
+	double seconds;
+} SharedReadStats;
+
+// Every publication of the stress test sets a rectangle to its own epoch, with the normal's
+// x equal to the height, so a consistent view has no value above its epoch, contains its
+// epoch, and holds it only inside its dirty rectangle.
+static bool CheckSharedView(const SharedTerrainView& view)
+{
+	const int rowLen = view.meshSize + 1;
+	bool seen = false;
+	for (int r = 0; r <= view.meshSize; r++)
+	{
+		for (int c = 0; c <= view.meshSize; c++)
+		{
+			float h = view.heights[r * rowLen + c];
+			if (h > (float)view.epoch || view.normals[r * rowLen + c].x != h)
+				return false;
+			if (h == (float)view.epoch)
+			{
+				if (c < view.dirtyC0 || c > view.dirtyC1 || r < view.dirtyR0 || r > view.dirtyR1)
+					return false;
+				seen = true;
+			}
+		}
+	}
+	return seen;
+}
+
+// Reader process: read until the last publication has been seen.
+static SharedReadStats ReadSharedTerrain(const char* name, unsigned long long lastEpoch)
+{
+	SharedReadStats stats = { 0, 0, 0, 0, 0 };
+	SharedTerrainReader reader;
+	OpenSharedTerrain(&reader, name);
+	double start = NowSeconds();
+	unsigned long long newest = 0;
+	while (newest < lastEpoch && NowSeconds() - start < 30)
+	{
+		SharedTerrainView view;
+		if (!BeginReadSharedTerrain(&reader, &view))
+			continue;
+		bool contentsOk = CheckSharedView(view);
+		if (!EndReadSharedTerrain(&reader, &view))
+		{
+			stats.retries++;
+			continue;
+		}
+		stats.views++;
+		stats.bad += contentsOk ? 0 : 1;
+		stats.stale += view.epoch < newest ? 1 : 0;
+		newest = view.epoch > newest ? view.epoch : newest;
+	}
+	stats.seconds = NowSeconds() - start;
+	if (newest < lastEpoch)
+		stats.bad++;
+	CloseSharedTerrain(&reader);
+	return stats;
+}
+
+// Writer side: stamp a random rectangle (or the whole mesh) with the next epoch and
+// return the rectangle.
+static MeshRect StampMesh(QuadMesh* qm, float value, bool whole)
+{
+	const int last = qm->meshSize;
+	int c0 = 0, r0 = 0, c1 = last, r1 = last;
+	if (!whole)
+	{
+		c0 = rand() % (last + 1);
+		r0 = rand() % (last + 1);
+		c1 = c0 + rand() % 16;
+		r1 = r0 + rand() % 16;
+		c1 = c1 < last ? c1 : last;
+		r1 = r1 < last ? r1 : last;
+	}
+	for (int r = r0; r <= r1; r++)
+	{
+		for (int c = c0; c <= c1; c++)
+		{
+			MeshVertex* v = &qm->vertices[r * (last + 1) + c];
+			v->position.y = value;
+			v->normal = NewVector3D(value, 1, 0);
+		}
+	}
+	MeshRect rect = { c0, r0, c1, r1 };
+	return rect;
+}
+
+// Writer side: the active buffer must hold exactly the mesh, which catches a buffer that
+// missed a rectangle of an earlier publication.
+static bool SharedMatchesMesh(SharedTerrainReader* reader, const QuadMesh* qm)
+{
+	SharedTerrainView view;
+	if (!BeginReadSharedTerrain(reader, &view) || view.meshSize != qm->meshSize)
+		return false;
+	bool same = true;
+	for (int i = 0; i < qm->numVertices && same; i++)
+		same = view.heights[i] == qm->vertices[i].position.y && view.normals[i].x == qm->vertices[i].normal.x;
+	return EndReadSharedTerrain(reader, &view) && same;
+}
+
+bool RunSharedTerrainBenchmarks()
+{
+	const int readerCount = 3;
+	const int publications = 20000;
+	const int meshSizes[2] = { 64, 256 };   // the second outgrows the segment halfway through
+	char name[64];
+	snprintf(name, sizeof(name), "/terrain-stress-%d", (int)getpid());
+
+	SharedTerrainWriter writer;
+	if (!CreateSharedTerrain(&writer, name, meshSizes[0]))
+	{
+		printf("Shared terrain: cannot create %s, skipped\n", name);
+		return true;
+	}
+
+	// Readers are separate processes reporting through a pipe
+	int fds[2];
+	if (pipe(fds) != 0)
+	{
+		DestroySharedTerrain(&writer);
+		return false;
+	}
+	std::vector<pid_t> children;
+	for (int i = 0; i < readerCount; i++)
+	{
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			close(fds[0]);
+			SharedReadStats stats = ReadSharedTerrain(name, publications);
+			ssize_t written = write(fds[1], &stats, sizeof(stats));
+			_exit(written == (ssize_t)sizeof(stats) ? 0 : 1);
+		}
+		if (pid > 0)
+			children.push_back(pid);
+	}
+	close(fds[1]);
+
+	// Only the stamped rectangle is passed on, except for the resizes which pass NULL
+	QuadMesh qm = NewQuadMesh(meshSizes[1]);
+	SharedTerrainReader check;
+	OpenSharedTerrain(&check, name);
+	bool matches = true;
+	double checkSeconds = 0;
+	double start = NowSeconds();
+	srand(5);
+	for (int p = 1; p <= publications; p++)
+	{
+		const bool resize = p == 1 || p == publications / 2;
+		if (resize)
+			InitBenchMesh(&qm, meshSizes[p == 1 ? 0 : 1], 32);
+		MeshRect stamped = StampMesh(&qm, (float)p, resize);
+		PublishSharedTerrainQM(&writer, &qm, resize ? NULL : &stamped);
+		if (p % 16 == 0)
+		{
+			double checkStart = NowSeconds();
+			matches = matches && SharedMatchesMesh(&check, &qm);
+			checkSeconds += NowSeconds() - checkStart;
+		}
+	}
+	double writeSeconds = NowSeconds() - start - checkSeconds;
+
+	bool ok = writer.epoch == (unsigned long long)publications && (int)children.size() == readerCount && matches;
+	SharedReadStats total = { 0, 0, 0, 0, 0 };
+	for (size_t i = 0; i < children.size(); i++)
+	{
+		SharedReadStats stats;
+		int status = 0;
+		if (read(fds[0], &stats, sizeof(stats)) != (ssize_t)sizeof(stats))
+			ok = false;
+		else
+		{
+			total.views += stats.views;
+			total.retries += stats.retries;
+			total.bad += stats.bad;
+			total.stale += stats.stale;
+			total.seconds = stats.seconds > total.seconds ? stats.seconds : total.seconds;
+		}
+		waitpid(children[i], &status, 0);
+		ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	}
+	close(fds[0]);
+
+	// A reader of an editor that shut down moves on to the next editor under the name
+	DestroySharedTerrain(&writer);
+	bool restarted = CreateSharedTerrain(&writer, name, meshSizes[1]);
+	if (restarted)
+	{
+		StampMesh(&qm, -1.0f, true);
+		PublishSharedTerrainQM(&writer, &qm, NULL);
+		restarted = SharedMatchesMesh(&check, &qm);
+		DestroySharedTerrain(&writer);
+	}
+	CloseSharedTerrain(&check);
+	FreeMemoryQM(&qm);
+	ok = ok && total.bad == 0 && total.stale == 0 && restarted;
+
+	printf("Shared terrain: %d publications (%dx%d growing to %dx%d) in %.3f s, %.1f us each\n", publications,
+		meshSizes[0], meshSizes[0], meshSizes[1], meshSizes[1], writeSeconds, writeSeconds * 1e6 / publications);
+	printf("%d reader processes: %lld consistent views, %lld retried, %lld inconsistent, %lld out of order, %s\n",
+		readerCount, total.views, total.retries, total.bad, total.stale, ok ? "ok" : "FAILED");
+	if (!matches)
+		printf("the published grid DOES NOT match the mesh\n");
+	if (!restarted)
+		printf("readers DO NOT follow a restarted writer\n");
+	return ok;
+}
+
+#else
+
+bool RunSharedTerrainBenchmarks()
+{
+	printf("Shared terrain: not available on this platform, skipped\n");
+	return true;
+}
+
+#endif
+
+#ifndef _WIN32
+
+bool RunTileServiceBenchmarks()
+{
+	const int meshSize = 512;
+	const int workerCounts[4] = { 1, 2, 4, 8 };
+	QuadMesh exact = MakeBenchMesh(meshSize, 256), tiled = MakeBenchMesh(meshSize, 256);
+
+	// A large extent covered by many local hills
+	std::vector<Metaball> blobs;
+	srand(6);
+	for (int k = 0; k < 2000; k++)
+	{
+		Metaball blob;
+		blob.pos = NewVector3D((float)rand() / RAND_MAX * 256, 0, -(float)rand() / RAND_MAX * 256);
+		blob.width = 0.05 + (double)rand() / RAND_MAX * 0.5;
+		blob.height = (double)rand() / RAND_MAX * 10 - 3;
+		blobs.push_back(blob);
+	}
+
+	double start = NowSeconds();
+	UpdateMesh(&exact, blobs);
+	double exactSeconds = NowSeconds() - start;
+
+	TileServiceOptions options;
+	DefaultTileServiceOptions(&options);
+	options.tileSize = 64;
+	const double maxError = options.cullTolerance * blobs.size();
+
+	printf("Tile service: %dx%d mesh, %d blobs, %dx%d tiles, single process %.3f s\n", meshSize, meshSize,
+		(int)blobs.size(), options.tileSize, options.tileSize, exactSeconds);
+	printf("%8s %9s %10s %10s %12s %11s %10s %8s %11s %s\n", "workers", "start ms", "seconds", "scaling",
+		"vs 1 process", "blobs/tile", "MB moved", "retries", "max error", "");
+
+	bool ok = true;
+	double oneWorkerSeconds = 0;
+	for (int n = 0; n < 5; n++)
+	{
+		// The last run has one worker in five crashing on each tile it receives
+		const bool injectFailures = n == 4;
+		options.workers = injectFailures ? 4 : workerCounts[n];
+		options.failRate = injectFailures ? 0.2 : 0;
+		options.maxAttempts = injectFailures ? 10 : 3;
+
+		TileService service;
+		start = NowSeconds();
+		if (!StartTileService(&service, &options))
+		{
+			printf("cannot start %d workers\n", options.workers);
+			ok = false;
+			break;
+		}
+		double startMs = (NowSeconds() - start) * 1e3;
+
+		TileServiceReport report;
+		bool generated = GenerateTilesQM(&service, &tiled, blobs, &report);
+		StopTileService(&service);
+
+		double error = 0;
+		bool normalsMatch = true;
+		for (int i = 0; i < exact.numVertices; i++)
+		{
+			double e = fabs(exact.vertices[i].position.y - tiled.vertices[i].position.y);
+			error = e > error ? e : error;
+			Vector3D d;
+			Subtract(&exact.vertices[i].normal, &tiled.vertices[i].normal, &d);
+			normalsMatch = normalsMatch && GetLength(&d) < 1e-3f;
+		}
+		bool runOk = generated && error <= maxError && normalsMatch;
+		ok = ok && runOk;
+		if (n == 0)
+			oneWorkerSeconds = report.seconds;
+
+		// Scaling is relative to one worker; the comparison with one process also
+		// includes the metaballs culled per tile
+		printf("%8d %9.1f %10.3f %9.2fx %11.2fx %11.1f %10.2f %8d %11.2e %s\n", options.workers, startMs, report.seconds,
+			oneWorkerSeconds / report.seconds, exactSeconds / report.seconds, (double)report.blobsSent / report.tiles,
+			(report.bytesSent + report.bytesReceived) / 1048576.0, report.retries, error,
+			!runOk ? "FAILED" : (injectFailures ? "(with failures injected)" : ""));
+	}
+
+	FreeMemoryQM(&exact);
+	FreeMemoryQM(&tiled);
+	return ok;
+}
+
+#else
+
+bool RunTileServiceBenchmarks()
+{
+	printf("Tile service: not available on this platform, skipped\n");
+	return true;
+}
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+// Microbenchmarks run by "TerrainBatch -bench". Each prints its own report and returns
+// false if a correctness check failed.
+
+bool RunVectorBenchmarks();
+bool RunProgressiveBenchmarks();      // exact match of the coarse-to-fine path
+bool RunQueryBenchmarks();
+bool RunFGTBenchmarks();
+bool RunOcclusionBenchmarks();
+bool RunSharedTerrainBenchmarks();       // stress test with concurrent reader processes
+bool RunTileServiceBenchmarks();         // scaling with the number of worker processes
+
+#endif	//BENCHMARKS_H
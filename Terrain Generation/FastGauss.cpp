@@ -0,0 +1,316 @@
+#include <math.h>
+#include <map>
+#include <vector>
+
+#include "FastGauss.h"
+
+static const double clusterRadii[3] = { 0.5, 1.0, 1.5 };   // candidate cluster radii, in bandwidths
+static const int maxClusters = 4096;
+static const double expCost = 8;            // cost of an exp() relative to a multiply-add
+static const int maxOrder = 24;
+static const int minExpandedBlobs = 16;     // smaller groups are always summed directly
+
+// A blob reduced to a 2D Gaussian source: weight * exp(-|p - (x, z)|^2 / h^2).
+typedef struct GaussSource
+{
+	double x, z;
+	double weight;
+} GaussSource;
+
+typedef struct GridInfo
+{
+	int last;              // meshSize
+	int rowLen;
+	double originX, originZ;
+	double stepX, stepZ;
+} GridInfo;
+
+// Inclusive range of vertices whose position lies within 'radius' of (x, z) along each axis.
+static bool VertexBox(const GridInfo& g, double x, double z, double radius, int* c0, int* c1, int* r0, int* r1)
+{
+	double u = (x - g.originX) / g.stepX, du = radius / fabs(g.stepX);
+	double v = (z - g.originZ) / g.stepZ, dv = radius / fabs(g.stepZ);
+	double lo = ceil(u - du), hi = floor(u + du);
+	*c0 = lo < 0 ? 0 : (int)lo;
+	*c1 = hi > g.last ? g.last : (int)hi;
+	lo = ceil(v - dv);
+	hi = floor(v + dv);
+	*r0 = lo < 0 ? 0 : (int)lo;
+	*r1 = hi > g.last ? g.last : (int)hi;
+	return *c0 <= *c1 && *r0 <= *r1;
+}
+
+static double BoxVertices(const GridInfo& g, double radius)
+{
+	double cols = 2 * radius / fabs(g.stepX) + 1, rows = 2 * radius / fabs(g.stepZ) + 1;
+	cols = cols < g.rowLen ? cols : g.rowLen;
+	rows = rows < g.rowLen ? rows : g.rowLen;
+	return cols * rows;
+}
+
+// Direct summation of each source over the vertices within the cutoff radius.
+static void SumDirect(QuadMesh* qm, const GridInfo& g, const std::vector<GaussSource>& sources, double h, double cutoff)
+{
+	const double invH2 = 1.0 / (h * h);
+	for (size_t s = 0; s < sources.size(); s++)
+	{
+		int c0, c1, r0, r1;
+		if (!VertexBox(g, sources[s].x, sources[s].z, cutoff, &c0, &c1, &r0, &r1))
+			continue;
+		for (int r = r0; r <= r1; r++)
+		{
+			MeshVertex* row = &qm->vertices[r * g.rowLen];
+			for (int c = c0; c <= c1; c++)
+			{
+				double dx = row[c].position.x - sources[s].x, dz = row[c].position.z - sources[s].z;
+				row[c].position.y += (float)(sources[s].weight * exp(-(dx*dx + dz*dz) * invH2));
+			}
+		}
+	}
+}
+
+// Farthest-point clustering: returns the centres and each source's cluster, stopping
+// once every source is within 'radius' of its centre. The reached radius is returned.
+static double ClusterSources(const std::vector<GaussSource>& sources, double radius,
+	std::vector<int>& centres, std::vector<int>& owner)
+{
+	const size_t n = sources.size();
+	std::vector<double> dist2(n, HUGE_VAL);
+	owner.assign(n, 0);
+	centres.clear();
+
+	size_t next = 0;
+	double farthest2 = HUGE_VAL;
+	while (farthest2 > radius * radius && (int)centres.size() < maxClusters && centres.size() < n)
+	{
+		const int k = (int)centres.size();
+		centres.push_back((int)next);
+		farthest2 = 0;
+		for (size_t i = 0; i < n; i++)
+		{
+			double dx = sources[i].x - sources[next].x, dz = sources[i].z - sources[next].z;
+			double d2 = dx*dx + dz*dz;
+			if (d2 < dist2[i])
+			{
+				dist2[i] = d2;
+				owner[i] = k;
+			}
+		}
+		for (size_t i = 0; i < n; i++)
+		{
+			if (dist2[i] > farthest2)
+			{
+				farthest2 = dist2[i];
+				next = i;
+			}
+		}
+	}
+	return sqrt(farthest2);
+}
+
+// Smallest truncation order whose error bound is below 'tolerance', or 0 if none up to
+// maxOrder. a and b are the cluster and cutoff radii in bandwidths. Per source the
+// truncation error is at most |q| 2^p/p! a^p max_{t<=b} t^p exp(-(t - a)^2).
+static int TruncationOrder(double totalWeight, double a, double b, double tolerance)
+{
+	if (a < 1e-12)
+		return 1;
+	for (int p = 1; p <= maxOrder; p++)
+	{
+		double t = 0.5 * (a + sqrt(a * a + 2.0 * p));
+		t = t < b ? t : b;
+		double logBound = log(totalWeight) + p * log(2.0) - lgamma(p + 1.0) + p * log(a) + p * log(t) - (t - a) * (t - a);
+		if (logBound <= log(tolerance))
+			return p;
+	}
+	return 0;
+}
+
+// Evaluates the group through cluster expansions. Returns false (doing nothing) when
+// direct summation would be cheaper.
+static bool SumExpanded(QuadMesh* qm, const GridInfo& g, const std::vector<GaussSource>& sources,
+	double h, double totalWeight, double tolerance, double directCost, FGTReport* report)
+{
+	// Larger clusters mean fewer expansions but a higher order; keep the cheapest plan
+	std::vector<int> centres, owner, candidateCentres, candidateOwner;
+	double ry = 0, bestCost = directCost;
+	int p = 0;
+	for (int c = 0; c < 3; c++)
+	{
+		double candidateRx = ClusterSources(sources, clusterRadii[c] * h, candidateCentres, candidateOwner);
+		// Half the tolerance for the cutoff, half for the truncated series
+		double candidateRy = candidateRx + h * sqrt(log(2.0 * totalWeight / tolerance));
+		int order = TruncationOrder(totalWeight, candidateRx / h, candidateRy / h, 0.5 * tolerance);
+		if (order == 0)
+			continue;
+
+		const double K = (double)candidateCentres.size();
+		const double terms = order * (order + 1) / 2.0;
+		const double side = sqrt(BoxVertices(g, candidateRy));
+		// Clustering and coefficients, then per cluster the column and row factors and
+		// 'order' multiply-adds for each vertex inside the cutoff disc
+		const double cost = sources.size() * (K + terms + expCost)
+			+ K * (side * (2 * expCost + 2 * order + terms) + 0.8 * side * side * order);
+		if (cost < bestCost)
+		{
+			bestCost = cost;
+			ry = candidateRy;
+			p = order;
+			centres.swap(candidateCentres);
+			owner.swap(candidateOwner);
+		}
+	}
+	if (p == 0)
+		return false;
+
+	// C[k][a][b] = 2^(a+b) / (a! b!) * sum_i q_i exp(-|d_i|^2) dx_i^a dz_i^b with d_i = (x_i - c_k) / h
+	const size_t K = centres.size();
+	std::vector<double> coeffs(K * p * p, 0.0);
+	std::vector<double> powX(p), powZ(p);
+	for (size_t i = 0; i < sources.size(); i++)
+	{
+		const GaussSource& c = sources[centres[owner[i]]];
+		double dx = (sources[i].x - c.x) / h, dz = (sources[i].z - c.z) / h;
+		double base = sources[i].weight * exp(-(dx*dx + dz*dz));
+		powX[0] = powZ[0] = 1;
+		for (int a = 1; a < p; a++)
+		{
+			powX[a] = powX[a - 1] * dx;
+			powZ[a] = powZ[a - 1] * dz;
+		}
+		double* C = &coeffs[owner[i] * p * p];
+		for (int a = 0; a < p; a++)
+			for (int b = 0; a + b < p; b++)
+				C[a * p + b] += base * powX[a] * powZ[b];
+	}
+	std::vector<double> scale(p);
+	scale[0] = 1;
+	for (int a = 1; a < p; a++)
+		scale[a] = scale[a - 1] * 2.0 / a;
+	for (size_t k = 0; k < K; k++)
+		for (int a = 0; a < p; a++)
+			for (int b = 0; a + b < p; b++)
+				coeffs[k * p * p + a * p + b] *= scale[a] * scale[b];
+
+	// On the grid the expansion separates: exp(-|e|^2) e^(a,b) = [exp(-ex^2) ex^a] [exp(-ez^2) ez^b].
+	// Column factors are computed once per cluster, the b sum once per row, leaving p
+	// multiply-adds per vertex.
+	const double ryh2 = (ry / h) * (ry / h);
+	std::vector<double> columnTerms, rowTerms(p);
+	for (size_t k = 0; k < K; k++)
+	{
+		const GaussSource& c = sources[centres[k]];
+		const double* C = &coeffs[k * p * p];
+		int c0, c1, r0, r1;
+		if (!VertexBox(g, c.x, c.z, ry, &c0, &c1, &r0, &r1))
+			continue;
+
+		columnTerms.resize((size_t)(c1 - c0 + 1) * p);
+		std::vector<double> columnX(c1 - c0 + 1);
+		for (int col = c0; col <= c1; col++)
+		{
+			double ex = (qm->vertices[col].position.x - c.x) / h;
+			double* E = &columnTerms[(size_t)(col - c0) * p];
+			columnX[col - c0] = ex;
+			E[0] = exp(-ex * ex);
+			for (int a = 1; a < p; a++)
+				E[a] = E[a - 1] * ex;
+		}
+
+		for (int r = r0; r <= r1; r++)
+		{
+			MeshVertex* row = &qm->vertices[r * g.rowLen];
+			double ez = (row[0].position.z - c.z) / h;
+			if (ez * ez > ryh2)
+				continue;
+			const double reach = sqrt(ryh2 - ez * ez);
+			const double rowFactor = exp(-ez * ez);
+			for (int a = 0; a < p; a++)
+			{
+				double inner = 0;
+				for (int b = p - 1 - a; b >= 0; b--)
+					inner = inner * ez + C[a * p + b];
+				rowTerms[a] = inner * rowFactor;
+			}
+
+			for (int col = c0; col <= c1; col++)
+			{
+				if (fabs(columnX[col - c0]) > reach)
+					continue;
+				const double* E = &columnTerms[(size_t)(col - c0) * p];
+				double sum = 0;
+				for (int a = 0; a < p; a++)
+					sum += rowTerms[a] * E[a];
+				row[col].position.y += (float)sum;
+			}
+		}
+	}
+
+	if (report != NULL)
+	{
+		report->expandedBlobs += (int)sources.size();
+		report->clusters += (int)K;
+		report->maxOrder = p > report->maxOrder ? p : report->maxOrder;
+	}
+	return true;
+}
+
+void UpdateMeshFGT(QuadMesh* qm, const std::vector<Metaball>& blobList, double tolerance, FGTReport* report)
+{
+	const int rowLen = qm->meshSize + 1;
+	GridInfo g;
+	g.last = qm->meshSize;
+	g.rowLen = rowLen;
+	g.originX = qm->originX;
+	g.originZ = qm->originZ;
+	g.stepX = qm->stepX;
+	g.stepZ = qm->stepZ;
+
+	// Group by width; the blob's own y offset only scales its weight
+	std::map<double, std::vector<GaussSource> > groups;
+	for (size_t k = 0; k < blobList.size(); k++)
+	{
+		const Metaball& b = blobList[k];
+		if (b.width <= 0)
+			continue;
+		GaussSource s;
+		s.x = b.pos.x;
+		s.z = b.pos.z;
+		s.weight = b.height * exp(-b.width * b.pos.y * b.pos.y);
+		groups[b.width].push_back(s);
+	}
+
+	if (report != NULL)
+	{
+		report->groups = (int)groups.size();
+		report->expandedBlobs = report->exactBlobs = report->clusters = report->maxOrder = 0;
+	}
+
+	for (int i = 0; i < rowLen * rowLen; i++)
+		qm->vertices[i].position.y = 0;
+
+	const double groupTolerance = tolerance / (groups.size() > 0 ? groups.size() : 1);
+	for (std::map<double, std::vector<GaussSource> >::iterator it = groups.begin(); it != groups.end(); ++it)
+	{
+		const std::vector<GaussSource>& sources = it->second;
+		const double h = 1.0 / sqrt(it->first);
+		double totalWeight = 0;
+		for (size_t i = 0; i < sources.size(); i++)
+			totalWeight += fabs(sources[i].weight);
+		if (totalWeight <= groupTolerance)
+			continue;
+
+		const double cutoff = h * sqrt(log(totalWeight / groupTolerance));
+		const double directCost = (double)sources.size() * BoxVertices(g, cutoff) * expCost;
+		if ((int)sources.size() >= minExpandedBlobs
+			&& SumExpanded(qm, g, sources, h, totalWeight, groupTolerance, directCost, report))
+			continue;
+
+		SumDirect(qm, g, sources, h, cutoff);
+		if (report != NULL)
+			report->exactBlobs += (int)sources.size();
+	}
+
+	qm->refineStride = 0;
+	ComputeNormalsQM(qm);
+}
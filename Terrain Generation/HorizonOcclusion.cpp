@@ -0,0 +1,380 @@
+#include <math.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+#include "HorizonOcclusion.h"
+#include "MeshMemory.h"
+
+static const int numDirections = 8;
+// Grid steps (column, row) of the 8 horizon directions, in order around the compass
+static const int dirCol[numDirections] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+static const int dirRow[numDirections] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+
+static const float pi = 3.14159265f;
+static const float angleScale = 255.0f / (0.5f * pi);  // horizons are quantized over [0, pi/2]
+static const float penumbra = 0.07f;                   // radians (about 4 degrees) for the sun to set
+static const int linesPerTask = 16;
+static const int rowsPerTask = 32;
+static const int verticesPerThread = 1 << 16;          // less work than this per thread is not worth a thread
+static const float heightTolerance = 0.005f;           // in grid steps; smaller changes (far Gaussian tails) are ignored
+
+// Cosine-weighted part of the sky below each quantized horizon angle: sin^2(angle).
+struct OcclusionTable
+{
+	float entries[256];
+
+	OcclusionTable()
+	{
+		for (int i = 0; i < 256; i++)
+		{
+			float s = sinf(i / angleScale);
+			entries[i] = s * s;
+		}
+	}
+};
+
+typedef struct HorizonGrid
+{
+	int last;                            // meshSize
+	int rowLen;
+	const float* heights;
+	unsigned char* horizons;
+	float invStep[numDirections];        // 1 / horizontal distance between neighbours in each direction
+	float azimuth[numDirections];        // world azimuth of each direction in x/z
+} HorizonGrid;
+
+typedef struct LineStart
+{
+	int d;                               // direction the line is swept against
+	int r, c;                            // last vertex of the line in direction d
+} LineStart;
+
+typedef struct HullPoint
+{
+	float k;                             // steps from the start of the line
+	float h;
+} HullPoint;
+
+typedef struct SunTerms
+{
+	int d0, d1;                          // directions on either side of the sun's azimuth
+	float w;                             // weight of d1
+	float elevation;                     // radians above the horizontal
+} SunTerms;
+
+// Value that is the same for every vertex on a line of direction d.
+static int LineKey(int d, int r, int c)
+{
+	if (dirRow[d] == 0)
+		return r;
+	if (dirCol[d] == 0)
+		return c;
+	return dirCol[d] == dirRow[d] ? c - r : c + r;
+}
+
+// Keys of the lines of direction d that pass through the rectangle. The key is linear
+// in r and c, so its extremes are at the corners.
+static void KeyRange(int d, const MeshRect& rect, int* lo, int* hi)
+{
+	int k[4] = { LineKey(d, rect.r0, rect.c0), LineKey(d, rect.r0, rect.c1),
+		LineKey(d, rect.r1, rect.c0), LineKey(d, rect.r1, rect.c1) };
+	*lo = *hi = k[0];
+	for (int i = 1; i < 4; i++)
+	{
+		*lo = k[i] < *lo ? k[i] : *lo;
+		*hi = k[i] > *hi ? k[i] : *hi;
+	}
+}
+
+// Lines of every direction that cross the rectangle. Each line is identified by the
+// border vertex where it leaves the grid in its direction.
+static void CollectLines(int last, const MeshRect& rect, std::vector<LineStart>* lines)
+{
+	lines->clear();
+	for (int d = 0; d < numDirections; d++)
+	{
+		int lo, hi;
+		KeyRange(d, rect, &lo, &hi);
+		for (int i = 0; i < 4 * last; i++)
+		{
+			// Walk the border once: bottom row, right column, top row, left column
+			int side = i / last, t = i % last;
+			int r = side == 0 ? 0 : (side == 1 ? t : (side == 2 ? last : last - t));
+			int c = side == 0 ? t : (side == 1 ? last : (side == 2 ? last - t : 0));
+			int rn = r + dirRow[d], cn = c + dirCol[d];
+			if (rn >= 0 && rn <= last && cn >= 0 && cn <= last)
+				continue;
+			int key = LineKey(d, r, c);
+			if (key < lo || key > hi)
+				continue;
+			LineStart line = { d, r, c };
+			lines->push_back(line);
+		}
+	}
+}
+
+// Sweep one line backwards from its start. Every vertex already passed lies ahead of
+// the current one in direction d; of those, only the upper convex hull can be the
+// horizon, and the horizon is the hull point the current vertex is tangent to. Hull
+// points below the tangent can never be the horizon of a vertex further back either,
+// so each vertex is pushed and popped at most once.
+static void SweepLine(const HorizonGrid& g, const LineStart& line, HullPoint* hull)
+{
+	const int d = line.d;
+	const int stride = dirRow[d] * g.rowLen + dirCol[d];
+	int top = 0;
+	int idx = line.r * g.rowLen + line.c;
+
+	for (int r = line.r, c = line.c, k = 0; r >= 0 && r <= g.last && c >= 0 && c <= g.last;
+		r -= dirRow[d], c -= dirCol[d], k++, idx -= stride)
+	{
+		const float h = g.heights[idx];
+		while (top >= 2)
+		{
+			const HullPoint& t = hull[top - 1];
+			const HullPoint& s = hull[top - 2];
+			// Keep the top if it rises above the line from this vertex to the point below it
+			if ((t.h - h) * (k - s.k) > (s.h - h) * (k - t.k))
+				break;
+			top--;
+		}
+
+		float angle = 0;
+		if (top > 0)
+		{
+			float slope = (hull[top - 1].h - h) / (k - hull[top - 1].k) * g.invStep[d];
+			angle = slope > 0 ? atanf(slope) : 0;
+		}
+		g.horizons[idx * numDirections + d] = (unsigned char)(angle * angleScale + 0.5f);
+
+		hull[top].k = (float)k;
+		hull[top].h = h;
+		top++;
+	}
+}
+
+static void CombineVertices(QuadMesh* qm, const HorizonGrid& g, const SunTerms& sun, int r, int c0, int c1)
+{
+	static const OcclusionTable table;
+	const float w0 = 1.0f - sun.w;
+
+	for (int c = c0; c <= c1; c++)
+	{
+		const int idx = r * g.rowLen + c;
+		const unsigned char* hz = &g.horizons[idx * numDirections];
+		MeshVertex* v = &qm->vertices[idx];
+
+		float occlusion = 0;
+		for (int d = 0; d < numDirections; d++)
+			occlusion += table.entries[hz[d]];
+		v->occlusion = occlusion * (1.0f / numDirections);
+
+		float horizon = (hz[sun.d0] * w0 + hz[sun.d1] * sun.w) * (1.0f / angleScale);
+		float visibility = (sun.elevation - horizon) / penumbra + 0.5f;
+		v->sunVisibility = visibility < 0 ? 0 : (visibility > 1 ? 1 : visibility);
+	}
+}
+
+// Columns of row r on a swept line, as one interval covering every direction.
+static bool RowInterval(int last, const MeshRect& rect, int r, int* c0, int* c1)
+{
+	int lo = last + 1, hi = -1;
+	for (int d = 0; d < numDirections; d++)
+	{
+		int klo, khi, a, b;
+		KeyRange(d, rect, &klo, &khi);
+		if (dirRow[d] == 0)
+		{
+			if (r < klo || r > khi)
+				continue;
+			a = 0;
+			b = last;
+		}
+		else if (dirCol[d] == 0)
+		{
+			a = klo;
+			b = khi;
+		}
+		else if (dirCol[d] == dirRow[d])
+		{
+			a = klo + r;
+			b = khi + r;
+		}
+		else
+		{
+			a = klo - r;
+			b = khi - r;
+		}
+		lo = a < lo ? a : lo;
+		hi = b > hi ? b : hi;
+	}
+	*c0 = lo < 0 ? 0 : lo;
+	*c1 = hi > last ? last : hi;
+	return *c0 <= *c1;
+}
+
+static float WrapAngle(float a)
+{
+	while (a > pi)
+		a -= 2 * pi;
+	while (a <= -pi)
+		a += 2 * pi;
+	return a;
+}
+
+// Pick the two directions whose azimuths bracket the sun's.
+static SunTerms SunTermsFor(const HorizonGrid& g, Vector3D sunDir)
+{
+	SunTerms sun;
+	sun.d0 = sun.d1 = 0;
+	sun.w = 0;
+	float flat = sqrtf(sunDir.x * sunDir.x + sunDir.z * sunDir.z);
+	sun.elevation = atan2f(sunDir.y, flat);
+	if (flat == 0)
+		return sun;
+
+	float azimuth = atan2f(sunDir.z, sunDir.x);
+	for (int d = 0; d < numDirections; d++)
+	{
+		int next = (d + 1) % numDirections;
+		float span = WrapAngle(g.azimuth[next] - g.azimuth[d]);
+		float offset = WrapAngle(azimuth - g.azimuth[d]);
+		if (span != 0 && offset / span >= 0 && offset / span <= 1)
+		{
+			sun.d0 = d;
+			sun.d1 = next;
+			sun.w = offset / span;
+			break;
+		}
+	}
+	return sun;
+}
+
+// Run fn(begin, end) over [0, count) in chunks of 'grain' on up to 'threads' threads.
+template <typename Fn>
+static void ParallelFor(int count, int grain, int threads, Fn fn)
+{
+	std::atomic<int> next(0);
+	auto work = [&]() {
+		for (int begin = next.fetch_add(grain); begin < count; begin = next.fetch_add(grain))
+			fn(begin, begin + grain < count ? begin + grain : count);
+	};
+
+	std::vector<std::thread> pool;
+	for (int t = 1; t < threads; t++)
+		pool.push_back(std::thread(work));
+	work();
+	for (size_t t = 0; t < pool.size(); t++)
+		pool[t].join();
+}
+
+static int ThreadsFor(double vertices)
+{
+	int hardware = (int)std::thread::hardware_concurrency();
+	int useful = 1 + (int)(vertices / verticesPerThread);
+	return useful < hardware ? useful : (hardware > 1 ? hardware : 1);
+}
+
+// Bring the stored heights up to date and return the bounding box of the ones that changed.
+// A stored height is only replaced once it is off by more than the tolerance, so an edit
+// does not dirty the whole grid through the tails of its Gaussian.
+static MeshRect UpdateShadedHeights(QuadMesh* qm, bool all)
+{
+	const int last = qm->meshSize;
+	const float tolerance = heightTolerance * fabsf(qm->stepX);
+	MeshRect rect = EmptyRectQM();
+
+	for (int r = 0; r <= last; r++)
+	{
+		for (int c = 0; c <= last; c++)
+		{
+			const int idx = r * (last + 1) + c;
+			const float h = qm->vertices[idx].position.y;
+			if (!all && fabsf(qm->shadedHeights[idx] - h) <= tolerance)
+				continue;
+			qm->shadedHeights[idx] = h;
+			const MeshRect vertex = { c, r, c, r };
+			IncludeRectQM(&rect, &vertex);
+		}
+	}
+	return rect;
+}
+
+bool UpdateOcclusionQM(QuadMesh* qm, Vector3D sunDir)
+{
+	const int last = qm->meshSize;
+	const int rowLen = last + 1;
+	const size_t count = (size_t)rowLen * rowLen;
+	if (last < 1 || qm->vertices == NULL)
+		return false;
+
+	// Horizons are only kept for the current resolution; InitMeshQM makes them stale
+	const bool full = qm->shadedSize != last;
+	if (full)
+	{
+		if (qm->horizons != NULL)
+			FreeMeshMemory(qm->horizons);
+		if (qm->shadedHeights != NULL)
+			FreeMeshMemory(qm->shadedHeights);
+		qm->horizons = (unsigned char*)AllocMeshMemory(count * numDirections);
+		qm->shadedHeights = (float*)AllocMeshMemory(count * sizeof(float));
+		if (qm->horizons == NULL || qm->shadedHeights == NULL)
+		{
+			if (qm->horizons != NULL)
+				FreeMeshMemory(qm->horizons);
+			if (qm->shadedHeights != NULL)
+				FreeMeshMemory(qm->shadedHeights);
+			qm->horizons = NULL;
+			qm->shadedHeights = NULL;
+			qm->shadedSize = 0;
+			return false;
+		}
+	}
+
+	const MeshRect rect = UpdateShadedHeights(qm, full);
+	const bool changed = rect.c0 <= rect.c1;
+	const bool sunMoved = full || sunDir.x != qm->shadedSun.x || sunDir.y != qm->shadedSun.y || sunDir.z != qm->shadedSun.z;
+	qm->shadedSize = last;
+	qm->shadedSun = sunDir;
+	if (!changed && !sunMoved)
+		return true;
+
+	HorizonGrid g;
+	g.last = last;
+	g.rowLen = rowLen;
+	g.heights = qm->shadedHeights;
+	g.horizons = qm->horizons;
+	for (int d = 0; d < numDirections; d++)
+	{
+		float x = dirCol[d] * qm->stepX;
+		float z = dirRow[d] * qm->stepZ;
+		g.invStep[d] = 1.0f / sqrtf(x * x + z * z);
+		g.azimuth[d] = atan2f(z, x);
+	}
+
+	if (changed)
+	{
+		std::vector<LineStart> lines;
+		CollectLines(last, rect, &lines);
+		ParallelFor((int)lines.size(), linesPerTask, ThreadsFor((double)lines.size() * rowLen),
+			[&](int begin, int end) {
+				std::vector<HullPoint> hull(rowLen);
+				for (int i = begin; i < end; i++)
+					SweepLine(g, lines[i], hull.data());
+			});
+	}
+
+	// Recombine every vertex on a swept line, or all of them when the sun moved
+	const SunTerms sun = SunTermsFor(g, sunDir);
+	ParallelFor(rowLen, rowsPerTask, ThreadsFor((double)count),
+		[&](int begin, int end) {
+			for (int r = begin; r < end; r++)
+			{
+				int c0 = 0, c1 = last;
+				if (sunMoved || RowInterval(last, rect, r, &c0, &c1))
+					CombineVertices(qm, g, sun, r, c0, c1);
+			}
+		});
+	return true;
+}
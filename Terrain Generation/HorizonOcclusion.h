@@ -0,0 +1,25 @@
+#ifndef HORIZONOCCLUSION_H
+#define HORIZONOCCLUSION_H
+
+#include "QuadMesh.h"
+
+// Baked horizon-based ambient occlusion and sun visibility for a height grid.
+//
+// For every vertex the elevation angle of the horizon is found in the 8 grid directions
+// (along rows, columns and both diagonals). Each grid line is swept once per direction
+// while keeping the upper convex hull of the heights already passed, so the horizon of a
+// vertex is the hull point it is tangent to and a line of n vertices costs O(n) instead
+// of the O(n^2) of marching a ray from every vertex. Lines are shared out between threads.
+//
+// From the horizons, MeshVertex::occlusion is the cosine-weighted part of the sky below
+// the horizon averaged over the 8 directions, and MeshVertex::sunVisibility compares the
+// sun's elevation with the horizon interpolated at the sun's azimuth (with a small
+// penumbra). Heights are remembered between calls: only the lines through the bounding
+// box of the vertices whose height changed are swept again. Changing the sun direction
+// only recombines the stored horizons.
+
+// Recompute the occlusion terms after the heights changed. sunDir points towards the sun.
+// Returns false if the horizon buffers could not be allocated.
+bool UpdateOcclusionQM(QuadMesh* qm, Vector3D sunDir);
+
+#endif	//HORIZONOCCLUSION_H
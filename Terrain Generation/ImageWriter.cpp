@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "ImageWriter.h"
+
+// CRC-32 lookup table, built once (thread-safe static initialisation).
+struct CRCTable
+{
+	uint32_t entries[256];
+
+	CRCTable()
+	{
+		for (uint32_t n = 0; n < 256; n++)
+		{
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++)
+				c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			entries[n] = c;
+		}
+	}
+};
+
+static uint32_t UpdateCRC(uint32_t crc, const uint8_t* data, size_t len)
+{
+	static const CRCTable table;
+	for (size_t i = 0; i < len; i++)
+		crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+static void PutBE32(std::vector<uint8_t>& out, uint32_t v)
+{
+	out.push_back((uint8_t)(v >> 24));
+	out.push_back((uint8_t)(v >> 16));
+	out.push_back((uint8_t)(v >> 8));
+	out.push_back((uint8_t)v);
+}
+
+static bool WriteChunk(FILE* fp, const char* type, const std::vector<uint8_t>& data)
+{
+	std::vector<uint8_t> chunk;
+	PutBE32(chunk, (uint32_t)data.size());
+	chunk.insert(chunk.end(), type, type + 4);
+	chunk.insert(chunk.end(), data.begin(), data.end());
+	uint32_t crc = UpdateCRC(0xFFFFFFFFu, &chunk[4], chunk.size() - 4) ^ 0xFFFFFFFFu;
+	PutBE32(chunk, crc);
+	return fwrite(chunk.data(), 1, chunk.size(), fp) == chunk.size();
+}
+
+// Wraps the filtered scanlines in a zlib stream made of stored deflate blocks.
+static void StoreZlib(const std::vector<uint8_t>& raw, std::vector<uint8_t>& out)
+{
+	const size_t maxBlock = 65535;
+	out.clear();
+	out.reserve(raw.size() + raw.size() / maxBlock * 5 + 16);
+	out.push_back(0x78);
+	out.push_back(0x01);
+
+	size_t pos = 0;
+	do
+	{
+		size_t len = raw.size() - pos < maxBlock ? raw.size() - pos : maxBlock;
+		bool final = pos + len == raw.size();
+		out.push_back(final ? 1 : 0);
+		out.push_back((uint8_t)len);
+		out.push_back((uint8_t)(len >> 8));
+		out.push_back((uint8_t)~len);
+		out.push_back((uint8_t)(~len >> 8));
+		out.insert(out.end(), raw.begin() + pos, raw.begin() + pos + len);
+		pos += len;
+	} while (pos < raw.size());
+
+	uint32_t a = 1, b = 0;
+	for (size_t i = 0; i < raw.size(); i++)
+	{
+		a = (a + raw[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	PutBE32(out, (b << 16) | a);
+}
+
+static bool WritePNG(const char* path, int width, int height, int bitDepth, int colorType, int bytesPerPixel, const uint8_t* rows)
+{
+	// Every scanline is prefixed with filter type 0 (none)
+	const size_t stride = (size_t)width * bytesPerPixel;
+	std::vector<uint8_t> raw((stride + 1) * height);
+	for (int y = 0; y < height; y++)
+	{
+		raw[y * (stride + 1)] = 0;
+		memcpy(&raw[y * (stride + 1) + 1], rows + y * stride, stride);
+	}
+
+	std::vector<uint8_t> header;
+	PutBE32(header, (uint32_t)width);
+	PutBE32(header, (uint32_t)height);
+	header.push_back((uint8_t)bitDepth);
+	header.push_back((uint8_t)colorType);
+	header.push_back(0);	// compression
+	header.push_back(0);	// filter
+	header.push_back(0);	// interlace
+
+	std::vector<uint8_t> idat;
+	StoreZlib(raw, idat);
+
+	FILE* fp = fopen(path, "wb");
+	if (fp == NULL)
+		return false;
+
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	bool ok = fwrite(signature, 1, 8, fp) == 8
+		&& WriteChunk(fp, "IHDR", header)
+		&& WriteChunk(fp, "IDAT", idat)
+		&& WriteChunk(fp, "IEND", std::vector<uint8_t>());
+	return fclose(fp) == 0 && ok;
+}
+
+bool WritePNG16Gray(const char* path, int width, int height, const uint16_t* samples)
+{
+	// PNG stores 16-bit samples big-endian
+	std::vector<uint8_t> rows((size_t)width * height * 2);
+	for (size_t i = 0; i < (size_t)width * height; i++)
+	{
+		rows[2 * i] = (uint8_t)(samples[i] >> 8);
+		rows[2 * i + 1] = (uint8_t)samples[i];
+	}
+	return WritePNG(path, width, height, 16, 0, 2, rows.data());
+}
+
+bool WritePNG8RGB(const char* path, int width, int height, const uint8_t* pixels)
+{
+	return WritePNG(path, width, height, 8, 2, 3, pixels);
+}
+
+bool WriteRaw16(const char* path, int width, int height, const uint16_t* samples)
+{
+	std::vector<uint8_t> bytes((size_t)width * height * 2);
+	for (size_t i = 0; i < (size_t)width * height; i++)
+	{
+		bytes[2 * i] = (uint8_t)samples[i];
+		bytes[2 * i + 1] = (uint8_t)(samples[i] >> 8);
+	}
+
+	FILE* fp = fopen(path, "wb");
+	if (fp == NULL)
+		return false;
+	bool ok = fwrite(bytes.data(), 1, bytes.size(), fp) == bytes.size();
+	return fclose(fp) == 0 && ok;
+}
@@ -0,0 +1,19 @@
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Minimal writers for the batch generator's heightmaps and normal maps.
+// PNGs are written with uncompressed (stored) deflate blocks so no zlib is needed.
+
+// 16-bit greyscale PNG, samples in row-major order.
+bool WritePNG16Gray(const char* path, int width, int height, const uint16_t* samples);
+
+// 8-bit RGB PNG, 3 bytes per pixel in row-major order.
+bool WritePNG8RGB(const char* path, int width, int height, const uint8_t* pixels);
+
+// Headerless little-endian 16-bit samples (.r16), row-major.
+bool WriteRaw16(const char* path, int width, int height, const uint16_t* samples);
+
+#endif	//IMAGEWRITER_H
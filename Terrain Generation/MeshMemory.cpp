@@ -0,0 +1,188 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+
+#ifdef _WIN32
+#include <malloc.h>
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "MeshMemory.h"
+
+static const size_t cacheLineSize = 64;
+static const size_t hugePageSize = 2 * 1024 * 1024;
+
+static std::mutex poolMutex;
+static std::unordered_map<void*, size_t> liveBuffers;        // buffer -> size class
+static std::map<size_t, std::vector<void*> > cachedBuffers;  // size class -> free buffers
+static size_t cachedBytes = 0;
+static size_t inUseBytes = 0;
+static size_t cacheLimit = (size_t)1024 * 1024 * 1024;
+
+// Rounds up to 2^k, 1.25 * 2^k, 1.5 * 2^k or 1.75 * 2^k (at least one cache line).
+static size_t SizeClass(size_t bytes)
+{
+	if (bytes <= cacheLineSize)
+		return cacheLineSize;
+
+	size_t power = cacheLineSize;
+	while (power * 2 < bytes)
+		power *= 2;
+	size_t step = power / 4;
+	size_t size = (bytes + step - 1) / step * step;
+	return (size + cacheLineSize - 1) / cacheLineSize * cacheLineSize;
+}
+
+static void* SystemAlloc(size_t size)
+{
+	if (size >= hugePageSize)
+	{
+#ifdef _WIN32
+		// Large pages need SeLockMemoryPrivilege, so use regular pages (64 KB aligned)
+		return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+		// Over-map by one huge page and trim so the buffer starts on a 2 MB boundary
+		size_t mapped = size + hugePageSize;
+		void* base = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base == MAP_FAILED)
+			return NULL;
+		uintptr_t start = ((uintptr_t)base + hugePageSize - 1) & ~(uintptr_t)(hugePageSize - 1);
+		size_t head = start - (uintptr_t)base;
+		if (head > 0)
+			munmap(base, head);
+		munmap((void*)(start + size), mapped - head - size);
+#ifdef MADV_HUGEPAGE
+		madvise((void*)start, size, MADV_HUGEPAGE);
+#endif
+		return (void*)start;
+#endif
+	}
+
+#ifdef _WIN32
+	return _aligned_malloc(size, cacheLineSize);
+#else
+	void* ptr = NULL;
+	return posix_memalign(&ptr, cacheLineSize, size) == 0 ? ptr : NULL;
+#endif
+}
+
+static void SystemFree(void* ptr, size_t size)
+{
+	if (size >= hugePageSize)
+	{
+#ifdef _WIN32
+		VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+		munmap(ptr, size);
+#endif
+		return;
+	}
+
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+// Releases cached buffers, largest first, until the cache fits in 'limit'.
+// Called with poolMutex held.
+static void ShrinkCache(size_t limit)
+{
+	while (cachedBytes > limit && !cachedBuffers.empty())
+	{
+		std::map<size_t, std::vector<void*> >::iterator largest = --cachedBuffers.end();
+		SystemFree(largest->second.back(), largest->first);
+		cachedBytes -= largest->first;
+		largest->second.pop_back();
+		if (largest->second.empty())
+			cachedBuffers.erase(largest);
+	}
+}
+
+void* AllocMeshMemory(size_t bytes)
+{
+	const size_t size = SizeClass(bytes);
+	std::lock_guard<std::mutex> lock(poolMutex);
+
+	void* ptr = NULL;
+	std::map<size_t, std::vector<void*> >::iterator cached = cachedBuffers.find(size);
+	if (cached != cachedBuffers.end())
+	{
+		ptr = cached->second.back();
+		cached->second.pop_back();
+		if (cached->second.empty())
+			cachedBuffers.erase(cached);
+		cachedBytes -= size;
+	}
+	else
+	{
+		ptr = SystemAlloc(size);
+		if (ptr == NULL)
+		{
+			// Give the cache back and try once more before failing
+			ShrinkCache(0);
+			ptr = SystemAlloc(size);
+			if (ptr == NULL)
+				return NULL;
+		}
+	}
+
+	liveBuffers[ptr] = size;
+	inUseBytes += size;
+	return ptr;
+}
+
+void FreeMeshMemory(void* ptr)
+{
+	if (ptr == NULL)
+		return;
+
+	std::lock_guard<std::mutex> lock(poolMutex);
+	std::unordered_map<void*, size_t>::iterator live = liveBuffers.find(ptr);
+	if (live == liveBuffers.end())
+		return;
+
+	const size_t size = live->second;
+	liveBuffers.erase(live);
+	inUseBytes -= size;
+
+	if (size > cacheLimit)
+	{
+		SystemFree(ptr, size);
+		return;
+	}
+	cachedBuffers[size].push_back(ptr);
+	cachedBytes += size;
+	ShrinkCache(cacheLimit);
+}
+
+void SetMeshMemoryCacheLimit(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(poolMutex);
+	cacheLimit = bytes;
+	ShrinkCache(cacheLimit);
+}
+
+void TrimMeshMemory()
+{
+	std::lock_guard<std::mutex> lock(poolMutex);
+	ShrinkCache(0);
+}
+
+size_t MeshMemoryCached()
+{
+	std::lock_guard<std::mutex> lock(poolMutex);
+	return cachedBytes;
+}
+
+size_t MeshMemoryInUse()
+{
+	std::lock_guard<std::mutex> lock(poolMutex);
+	return inUseBytes;
+}
@@ -0,0 +1,26 @@
+#ifndef MESHMEMORY_H
+#define MESHMEMORY_H
+
+#include <stddef.h>
+
+// Pooled allocator for the large mesh arrays.
+//
+// Requests are rounded up to a size class (four classes per power of two, so at most
+// 25% is wasted) and freed buffers are cached per class, so switching mesh resolutions
+// back and forth reuses memory that is already mapped and faulted in instead of
+// fragmenting the heap. Every buffer is at least 64-byte aligned; buffers of 2 MB and
+// more are mapped separately, 2 MB aligned and marked for transparent huge pages where
+// the platform supports it.
+//
+// The cache holds at most the configured limit; beyond it freed buffers go back to the
+// system, which keeps peak memory at roughly the live meshes plus the cache limit.
+
+void* AllocMeshMemory(size_t bytes);
+void FreeMeshMemory(void* ptr);
+
+void SetMeshMemoryCacheLimit(size_t bytes);
+void TrimMeshMemory();                     // return every cached buffer to the system
+size_t MeshMemoryCached();                 // bytes held in the cache
+size_t MeshMemoryInUse();                  // bytes handed out (rounded to size classes)
+
+#endif	//MESHMEMORY_H
@@ -3,9 +3,15 @@
 #include <string.h>
 #include <math.h>
 #include <vector>
+#include <algorithm>
+#include <chrono>
+#ifndef QM_HEADLESS
 #include <gl/glut.h>
+#endif
 
 #include "QuadMesh.h"
+#include "VectorBatch.h"
+#include "MeshMemory.h"
 
 const int minMeshSize = 1;
 
@@ -14,9 +20,19 @@ QuadMesh NewQuadMesh(int maxMeshSize)
     QuadMesh qm;        // The new quad mesh to be returned
 	qm.numVertices = 0;
 	qm.vertices = NULL;
+	qm.meshSize = 0;
+	qm.originX = qm.originZ = 0.0f;
+	qm.stepX = qm.stepZ = 0.0f;
 	qm.numQuads = 0;
     qm.quads = NULL;
     qm.numFacesDrawn = 0;
+	qm.coarseStride = 4;
+	qm.refineStride = 0;
+	qm.refineRow = 0;
+	qm.shadedSize = 0;
+	qm.horizons = NULL;
+	qm.shadedHeights = NULL;
+	qm.shadedSun = NewVector3D(0.0f, 1.0f, 0.0f);
 	
 	qm.maxMeshSize = maxMeshSize < minMeshSize ? minMeshSize : maxMeshSize;
 	CreateMemoryQM(&qm);
@@ -56,18 +72,18 @@ void SetMaterialQM(QuadMesh* qm, Vector3D ambient, Vector3D diffuse, Vector3D sp
     qm->mat_shininess[0] = (float)shininess;
 }
 
-// Allocate dynamic arrays.
+// Allocate dynamic arrays from the mesh memory pool.
 bool CreateMemoryQM(QuadMesh* qm)
 {
-    const int maxVertices = (qm->maxMeshSize + 1) * (qm->maxMeshSize + 1);
-	qm->vertices = (MeshVertex*)malloc(sizeof(MeshVertex) * maxVertices);
+    const size_t maxVertices = (size_t)(qm->maxMeshSize + 1) * (qm->maxMeshSize + 1);
+	qm->vertices = (MeshVertex*)AllocMeshMemory(sizeof(MeshVertex) * maxVertices);
 	if (qm->vertices == NULL)
 	{
 		return false;
 	}
 
-    const int maxQuads = qm->maxMeshSize * qm->maxMeshSize;
-    qm->quads = (MeshQuad*)malloc(sizeof(MeshQuad) * maxQuads);
+    const size_t maxQuads = (size_t)qm->maxMeshSize * qm->maxMeshSize;
+    qm->quads = (MeshQuad*)AllocMeshMemory(sizeof(MeshQuad) * maxQuads);
     if (qm->quads == NULL)
 	{
 		return false;
@@ -75,11 +91,37 @@ bool CreateMemoryQM(QuadMesh* qm)
 
 	return true;
 }
-		
+
+// Replace the dynamic arrays with ones sized for a new maximum resolution. The old
+// arrays go back to the pool first, so alternating between sizes reuses them.
+bool ResizeMeshQM(QuadMesh* qm, int maxMeshSize)
+{
+	FreeMemoryQM(qm);
+	qm->maxMeshSize = maxMeshSize < minMeshSize ? minMeshSize : maxMeshSize;
+	if (!CreateMemoryQM(qm))
+	{
+		FreeMemoryQM(qm);
+		return false;
+	}
+	return true;
+}
 
 // Fills the array of vertices and the array of quads.
 bool InitMeshQM(QuadMesh* qm, int meshSize, Vector3D origin, double meshLength, double meshWidth, Vector3D dir1, Vector3D dir2)
 {
+	if (meshSize < minMeshSize || meshSize > qm->maxMeshSize || qm->vertices == NULL)
+	{
+		return false;
+	}
+	qm->meshSize = meshSize;
+	qm->refineStride = 0;
+	qm->shadedSize = 0;
+
+	// Start progressive evaluation with a coarse lattice of about 16 samples per side
+	qm->coarseStride = 2;
+	while (qm->coarseStride * 16 < meshSize)
+		qm->coarseStride *= 2;
+
 	Vector3D o;
 	double sf1, sf2; 
     
@@ -98,6 +140,11 @@ bool InitMeshQM(QuadMesh* qm, int meshSize, Vector3D origin, double meshLength,
 	sf2 = meshWidth/meshSize;
 	ScalarMul(&v2, (float)sf2, &v2);
 
+	qm->originX = origin.x;
+	qm->originZ = origin.z;
+	qm->stepX = v1.x;
+	qm->stepZ = v2.z;
+
 	Vector3D meshpt;
 	
 	// Build Vertices
@@ -117,6 +164,8 @@ bool InitMeshQM(QuadMesh* qm, int meshSize, Vector3D origin, double meshLength,
 			meshpt.z = o.z + j * v1.z;
             
 			Set(&qm->vertices[currentVertex].position, meshpt.x,meshpt.y,meshpt.z);
+			qm->vertices[currentVertex].occlusion = 0.0f;
+			qm->vertices[currentVertex].sunVisibility = 1.0f;
 			currentVertex++;
 		}
 		// go to next row in mesh (negative z direction)
@@ -145,6 +194,17 @@ bool InitMeshQM(QuadMesh* qm, int meshSize, Vector3D origin, double meshLength,
 	return true;
 }
 
+#ifndef QM_HEADLESS
+// Emit one vertex. The diffuse colour is darkened by the baked occlusion and sun
+// visibility terms, so relief shows up without any extra lights.
+static void DrawVertexQM(const QuadMesh* qm, const MeshVertex* v)
+{
+	float shade = (1.0f - v->occlusion) * (0.35f + 0.65f * v->sunVisibility);
+	glColor3f(qm->mat_diffuse[0] * shade, qm->mat_diffuse[1] * shade, qm->mat_diffuse[2] * shade);
+	glNormal3f(v->normal.x, v->normal.y, v->normal.z);
+	glVertex3f(v->position.x, v->position.y, v->position.z);
+}
+
 // Draw the mesh by drawing all quads.
 void DrawMeshQM(QuadMesh* qm, int meshSize)
 {
@@ -156,133 +216,298 @@ void DrawMeshQM(QuadMesh* qm, int meshSize)
 	glMaterialfv(GL_FRONT, GL_DIFFUSE, qm->mat_diffuse);
 	glMaterialfv(GL_FRONT, GL_SHININESS, qm->mat_shininess);
 
+	// The per-vertex colour replaces the diffuse material
+	glColorMaterial(GL_FRONT, GL_DIFFUSE);
+	glEnable(GL_COLOR_MATERIAL);
+
 	for(int j=0; j < meshSize; j++)
 	{
 		for(int k=0; k < meshSize; k++)
 		{
 			glBegin(GL_QUADS);
-			
-			glNormal3f(qm->quads[currentQuad].vertices[0]->normal.x,
-				       qm->quads[currentQuad].vertices[0]->normal.y,
-					   qm->quads[currentQuad].vertices[0]->normal.z);
-			glVertex3f(qm->quads[currentQuad].vertices[0]->position.x,
-				       qm->quads[currentQuad].vertices[0]->position.y,
-					   qm->quads[currentQuad].vertices[0]->position.z);
-			
-			glNormal3f(qm->quads[currentQuad].vertices[1]->normal.x,
-				       qm->quads[currentQuad].vertices[1]->normal.y,
-					   qm->quads[currentQuad].vertices[1]->normal.z);			
-			glVertex3f(qm->quads[currentQuad].vertices[1]->position.x,
-				       qm->quads[currentQuad].vertices[1]->position.y,
-					   qm->quads[currentQuad].vertices[1]->position.z);
-			
-			glNormal3f(qm->quads[currentQuad].vertices[2]->normal.x,
-				       qm->quads[currentQuad].vertices[2]->normal.y,
-					   qm->quads[currentQuad].vertices[2]->normal.z);			
-			glVertex3f(qm->quads[currentQuad].vertices[2]->position.x,
-				       qm->quads[currentQuad].vertices[2]->position.y,
-					   qm->quads[currentQuad].vertices[2]->position.z);
-			
-			glNormal3f(qm->quads[currentQuad].vertices[3]->normal.x,
-				       qm->quads[currentQuad].vertices[3]->normal.y,
-					   qm->quads[currentQuad].vertices[3]->normal.z);			
-			glVertex3f(qm->quads[currentQuad].vertices[3]->position.x,
-				       qm->quads[currentQuad].vertices[3]->position.y,
-					   qm->quads[currentQuad].vertices[3]->position.z);
-
+			DrawVertexQM(qm, qm->quads[currentQuad].vertices[0]);
+			DrawVertexQM(qm, qm->quads[currentQuad].vertices[1]);
+			DrawVertexQM(qm, qm->quads[currentQuad].vertices[2]);
+			DrawVertexQM(qm, qm->quads[currentQuad].vertices[3]);
 			glEnd();
 			currentQuad++;
 		}
 	}
+
+	glDisable(GL_COLOR_MATERIAL);
 }
 
+#endif
+
 // Deallocate dynamic arrays.
 void FreeMemoryQM(QuadMesh* qm)
 {
 	if (qm->vertices != NULL)
-		free(qm->vertices);
+		FreeMeshMemory(qm->vertices);
     qm->vertices=NULL;
     qm->numVertices=0;
 
 	if (qm->quads != NULL)
-		free(qm->quads);
+		FreeMeshMemory(qm->quads);
     qm->quads=NULL;
     qm->numQuads=0;
+    qm->meshSize=0;
+
+	if (qm->horizons != NULL)
+		FreeMeshMemory(qm->horizons);
+	qm->horizons=NULL;
+	if (qm->shadedHeights != NULL)
+		FreeMeshMemory(qm->shadedHeights);
+	qm->shadedHeights=NULL;
+	qm->shadedSize=0;
 }
 
-// Use cross-products to compute the normal vector at each vertex
-void ComputeNormalsQM(QuadMesh* qm)
+// Use cross-products to compute the normal vector at each vertex. The normal is the cross
+// product of the edge to the next vertex along the row and the edge to the next row; the
+// last column/row reuse the final edge. A row segment is computed at a time with the
+// batched vector operations.
+static void ComputeNormalsRectQM(QuadMesh* qm, int r0, int r1, int c0, int c1)
 {
-	int currentQuad=0;
-
-	for(int j=0; j < qm->maxMeshSize; j++)
+	const int last = qm->meshSize;
+	const int rowLen = last + 1;
+	if (last < 1 || r0 > r1 || c0 > c1)
+		return;
+
+	// Columns a..b hold every position the segment c0..c1 needs.
+	const int a = c0 < last ? c0 : last - 1;
+	const int b = c1 < last ? c1 + 1 : last;
+	const int n = b - a + 1;
+
+	std::vector<Vector3D> scratch(4 * n);
+	Vector3D* lo = &scratch[0];              // positions of the lower of the two rows
+	Vector3D* hi = &scratch[n];              // positions of the row above it
+	Vector3D* along = &scratch[2 * n];       // edges along the row
+	Vector3D* across = &scratch[3 * n];      // edges to the next row, then the normals
+
+	for (int r = r0; r <= r1; r++)
 	{
-		for(int k=0; k < qm->maxMeshSize; k++)
+		const int rl = r < last ? r : last - 1;
+		MeshVertex* row = &qm->vertices[r * rowLen];
+
+		for (int k = 0; k < n; k++)
 		{
-            Vector3D n0, n1, n2, n3;
-            Vector3D e0, e1, e2, e3;
-			
-			for (int i=0; i < 4; i++)
-			{ 
-				LoadZero(&qm->quads[currentQuad].vertices[i]->normal);
-			}
+			lo[k] = qm->vertices[rl * rowLen + a + k].position;
+			hi[k] = qm->vertices[(rl + 1) * rowLen + a + k].position;
+		}
 
-			Subtract(&qm->quads[currentQuad].vertices[1]->position, &qm->quads[currentQuad].vertices[0]->position, &e0);
-			Subtract(&qm->quads[currentQuad].vertices[2]->position, &qm->quads[currentQuad].vertices[1]->position, &e1);
-			Subtract(&qm->quads[currentQuad].vertices[3]->position, &qm->quads[currentQuad].vertices[2]->position, &e2);
-			Subtract(&qm->quads[currentQuad].vertices[0]->position, &qm->quads[currentQuad].vertices[3]->position, &e3);
-			Normalize(&e0);
-			Normalize(&e1);
-			Normalize(&e2);
-			Normalize(&e3);
-
-			Vector3D w;    // Working vector;
-
-			Negate(&e3, &w);
-			CrossProduct(&e0, &w, &n0);
-			Normalize(&n0);
-			Add(&qm->quads[currentQuad].vertices[0]->normal, &n0, &qm->quads[currentQuad].vertices[0]->normal);
-			
-			Negate(&e0, &w);
-			CrossProduct(&e1, &w, &n1);
-			Normalize(&n1);
-			Add(&qm->quads[currentQuad].vertices[1]->normal, &n1, &qm->quads[currentQuad].vertices[1]->normal);
-
-			Negate(&e1, &w);
-			CrossProduct(&e2, &w, &n2);
-			Normalize(&n2);
-			Add(&qm->quads[currentQuad].vertices[2]->normal, &n2, &qm->quads[currentQuad].vertices[2]->normal);
-
-			Negate(&e2, &w);
-			CrossProduct(&e3, &w, &n3);
-			Normalize(&n3);
-			Add(&qm->quads[currentQuad].vertices[3]->normal, &n3, &qm->quads[currentQuad].vertices[3]->normal);
-			
-			for (int i = 0; i < 4; i++)
-			{
-				Normalize(&qm->quads[currentQuad].vertices[i]->normal);
-			}
-			
-			currentQuad++;
+		Vector3D* p = (r == rl) ? lo : hi;
+		SubtractN(p + 1, p, along, n - 1);
+		along[n - 1] = along[n - 2];
+		SubtractN(hi, lo, across, n);
+
+		CrossProductN(along, across, across, n);
+		NormalizeN(across, n);
+
+		for (int c = c0; c <= c1; c++)
+		{
+			row[c].normal = across[c - a];
 		}
 	}
 }
 
+void ComputeNormalsQM(QuadMesh* qm)
+{
+	ComputeNormalsRectQM(qm, 0, qm->meshSize, 0, qm->meshSize);
+}
 
 
-void UpdateMesh(QuadMesh* qm, std::vector<Metaball> blobList) {
-	for (int i = 0; i < qm->maxMeshSize + 1; i++) {
-		for (int j = 0; j < qm->maxMeshSize + 1; j++) {
-			Vector3D pos = qm->vertices[i * (qm->maxMeshSize + 1) + j].position;
-			qm->vertices[i * (qm->maxMeshSize + 1) + j].position.y = 0;
-			pos.y = 0;
-			for (int k = 0; k <= (int)blobList.size() -1; k++) {
-				double distance = sqrt(pow(blobList[k].pos.x - pos.x, 2) + pow(blobList[k].pos.y - pos.y, 2) + pow(blobList[k].pos.z - pos.z, 2));
-				qm->vertices[i * (qm->maxMeshSize + 1) + j].position.y += blobList[k].height * exp(-(blobList[k].width * (distance*distance) ));
-			}
+
+// Height of the metaball field at (x, 0, z).
+float EvaluateHeightQM(const std::vector<Metaball>& blobList, float x, float z)
+{
+	double height = 0;
+	for (size_t k = 0; k < blobList.size(); k++) {
+		double dx = blobList[k].pos.x - x;
+		double dy = blobList[k].pos.y;
+		double dz = blobList[k].pos.z - z;
+		height += blobList[k].height * exp(-(blobList[k].width * (dx*dx + dy*dy + dz*dz)));
+	}
+	return (float)height;
+}
+
+void UpdateMesh(QuadMesh* qm, const std::vector<Metaball>& blobList) {
+	for (int i = 0; i < qm->meshSize + 1; i++) {
+		for (int j = 0; j < qm->meshSize + 1; j++) {
+			MeshVertex* v = &qm->vertices[i * (qm->meshSize + 1) + j];
+			v->position.y = EvaluateHeightQM(blobList, v->position.x, v->position.z);
 		}
 	}
+	qm->refineStride = 0;
 	ComputeNormalsQM(qm);
 }
 
+MeshRect EmptyRectQM()
+{
+	MeshRect rect = { 0, 0, -1, -1 };
+	return rect;
+}
+
+MeshRect FullRectQM(const QuadMesh* qm)
+{
+	MeshRect rect = { 0, 0, qm->meshSize, qm->meshSize };
+	return rect;
+}
 
+// Grow rect to the bounding rectangle of both.
+void IncludeRectQM(MeshRect* rect, const MeshRect* other)
+{
+	if (other->c0 > other->c1)
+		return;
+	if (rect->c0 > rect->c1)
+	{
+		*rect = *other;
+		return;
+	}
+	rect->c0 = std::min(rect->c0, other->c0);
+	rect->r0 = std::min(rect->r0, other->r0);
+	rect->c1 = std::max(rect->c1, other->c1);
+	rect->r1 = std::max(rect->r1, other->r1);
+}
+
+// Progressive evaluation works on nested lattices: the lattice of stride s holds every
+// s-th row/column plus the last one. Each pass halves the stride and only evaluates the
+// vertices that the previous lattice did not already have.
+static bool OnLattice(int i, int stride, int last)
+{
+	return i % stride == 0 || i == last;
+}
+
+static double ElapsedMs(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Bilinearly fill every vertex of rows r0..r1 and columns c0..c1 that is not on the
+// lattice of the given stride. The lattice rows around r0..r1 must already be evaluated.
+static void FillFromLatticeQM(QuadMesh* qm, int stride, int r0, int r1, int c0, int c1)
+{
+	const int last = qm->meshSize;
+	const int rowLen = last + 1;
+
+	for (int i = r0; i <= r1; i++) {
+		int i0 = (i == last) ? last : (i / stride) * stride;
+		int i1 = (i0 + stride < last) ? i0 + stride : last;
+		float ti = (i1 > i0) ? (float)(i - i0) / (i1 - i0) : 0.0f;
+
+		for (int j = c0; j <= c1; j++) {
+			if (i == i0 && OnLattice(j, stride, last))
+				continue;
+			int j0 = (j == last) ? last : (j / stride) * stride;
+			int j1 = (j0 + stride < last) ? j0 + stride : last;
+			float tj = (j1 > j0) ? (float)(j - j0) / (j1 - j0) : 0.0f;
+
+			float h00 = qm->vertices[i0 * rowLen + j0].position.y;
+			float h01 = qm->vertices[i0 * rowLen + j1].position.y;
+			float h10 = qm->vertices[i1 * rowLen + j0].position.y;
+			float h11 = qm->vertices[i1 * rowLen + j1].position.y;
+			float h0 = h00 + (h01 - h00) * tj;
+			float h1 = h10 + (h11 - h10) * tj;
+			qm->vertices[i * rowLen + j].position.y = h0 + (h1 - h0) * ti;
+		}
+	}
+}
+
+// Evaluate the field on the coarse lattice only and refill just the lattice cells around
+// the samples that changed, so a blob dragged across a large mesh costs in proportion to
+// the area it affects. Used while the field is changing every event. The coarse stride
+// adapts so that the whole call, filling and normals included, stays within half of the
+// frame budget.
+void BeginProgressiveQM(QuadMesh* qm, const std::vector<Metaball>& blobList, double budgetMs, MeshRect* changed)
+{
+	const int last = qm->meshSize;
+	const int rowLen = last + 1;
+	const int stride = qm->coarseStride;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	int r0 = last + 1, r1 = -1, c0 = last + 1, c1 = -1;
+	for (int i = 0; i <= last; i++) {
+		if (!OnLattice(i, stride, last))
+			continue;
+		for (int j = 0; j <= last; j++) {
+			if (!OnLattice(j, stride, last))
+				continue;
+			MeshVertex* v = &qm->vertices[i * rowLen + j];
+			float h = EvaluateHeightQM(blobList, v->position.x, v->position.z);
+			if (h == v->position.y)
+				continue;
+			v->position.y = h;
+			r0 = std::min(r0, i); r1 = std::max(r1, i);
+			c0 = std::min(c0, j); c1 = std::max(c1, j);
+		}
+	}
+
+	if (r1 >= 0) {
+		// Every vertex interpolated from a changed sample lies within one stride of it, and
+		// the normals reach one vertex further.
+		r0 = std::max(r0 - stride, 0); r1 = std::min(r1 + stride, last);
+		c0 = std::max(c0 - stride, 0); c1 = std::min(c1 + stride, last);
+		FillFromLatticeQM(qm, stride, r0, r1, c0, c1);
+		ComputeNormalsRectQM(qm, std::max(r0 - 1, 0), std::min(r1 + 1, last), std::max(c0 - 1, 0), std::min(c1 + 1, last));
+		if (changed != NULL)
+		{
+			MeshRect filled = { c0, r0, c1, r1 };
+			IncludeRectQM(changed, &filled);
+		}
+	}
+	double eventMs = ElapsedMs(start);
+
+	if (eventMs > budgetMs * 0.5 && qm->coarseStride < last)
+		qm->coarseStride *= 2;
+	else if (eventMs < budgetMs * 0.125 && qm->coarseStride > 2)
+		qm->coarseStride /= 2;
+
+	qm->refineStride = stride / 2;
+	qm->refineRow = 0;
+}
+
+// Continue refining towards full resolution for at most budgetMs, reusing every sample
+// computed by earlier passes. Each lattice row is followed by refilling the rows between
+// it and the previous lattice row and by the normals that became final, so all of the
+// work counts against the budget. Returns true once the mesh is at full resolution.
+bool RefineMeshQM(QuadMesh* qm, const std::vector<Metaball>& blobList, double budgetMs, MeshRect* changed)
+{
+	const int last = qm->meshSize;
+	const int rowLen = last + 1;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	while (qm->refineStride > 0) {
+		const int stride = qm->refineStride;
+		const int prev = stride * 2;
+
+		for (; qm->refineRow <= last; qm->refineRow++) {
+			int i = qm->refineRow;
+			if (!OnLattice(i, stride, last))
+				continue;
+			if (ElapsedMs(start) > budgetMs)
+				return false;
+
+			bool rowDone = OnLattice(i, prev, last);
+			for (int j = 0; j <= last; j++) {
+				if (!OnLattice(j, stride, last) || (rowDone && OnLattice(j, prev, last)))
+					continue;
+				MeshVertex* v = &qm->vertices[i * rowLen + j];
+				v->position.y = EvaluateHeightQM(blobList, v->position.x, v->position.z);
+			}
+
+			int p = (i == 0) ? -1 : ((i - 1) / stride) * stride;    // previous lattice row
+			if (stride > 1)
+				FillFromLatticeQM(qm, stride, p + 1, i, 0, last);
+			if (changed != NULL)
+			{
+				MeshRect rows = { 0, stride > 1 ? p + 1 : i, last, i };
+				IncludeRectQM(changed, &rows);
+			}
+			if (i > 0)
+				ComputeNormalsRectQM(qm, p, i == last ? last : i - 1, 0, last);
+		}
+
+		qm->refineStride = stride / 2;
+		qm->refineRow = 0;
+	}
+	return true;
+}
@@ -1,4 +1,13 @@
+#ifndef QUADMESH_H
+#define QUADMESH_H
+
 #include <stdbool.h>
+#include <vector>
+#ifdef QM_HEADLESS
+typedef float GLfloat;       // Tools built without OpenGL only need the material layout
+#else
+#include <gl/glut.h>
+#endif
 #include "Vector3D.h"
 
 typedef struct Metaball {
@@ -13,6 +22,8 @@ typedef struct MeshVertex
 {
 	Vector3D position;
 	Vector3D normal;
+	float occlusion;         // Cosine-weighted fraction of the sky hidden by terrain (0 = open)
+	float sunVisibility;     // 1 in full sun, 0 in the shadow of the terrain
 } MeshVertex;
 
 // Data structure for a quad (4-sided polygon)
@@ -22,11 +33,25 @@ typedef struct MeshQuad
 	MeshVertex *vertices[4];	
 } MeshQuad;
 
+// Inclusive rectangle of vertex columns and rows, empty when c0 > c1
+typedef struct MeshRect
+{
+	int c0, r0, c1, r1;
+} MeshRect;
+
 typedef struct
 {
 	int maxMeshSize;
+	int meshSize;            // Resolution set by InitMeshQM, at most maxMeshSize
 	float meshDim;
 
+	// Grid placement set by InitMeshQM: vertex (row r, column c) lies at x = originX +
+	// c * stepX, z = originZ + r * stepZ. Everything that samples the grid by position
+	// (queries, FGT, occlusion, shared publication) assumes it is level and axis-aligned
+	// in x/z, i.e. dir1 along x and dir2 along z, as every caller builds it.
+	float originX, originZ;
+	float stepX, stepZ;
+
 	int numVertices;
 	MeshVertex *vertices;    // Dynamic array of all vertices
 
@@ -34,6 +59,17 @@ typedef struct
 	MeshQuad *quads;         // Dynamic array of all quads
 
 	int numFacesDrawn;
+
+	// Progressive (coarse-to-fine) evaluation state
+	int coarseStride;        // Lattice spacing of the first pass, adapted to the frame budget
+	int refineStride;        // Lattice spacing of the pass being refined, 0 when fully refined
+	int refineRow;           // Next row of the current pass to evaluate
+
+	// Horizon occlusion state (see HorizonOcclusion.h)
+	int shadedSize;          // meshSize the horizons were computed for, 0 when they are stale
+	unsigned char* horizons; // Quantized horizon angle of every vertex in 8 directions
+	float* shadedHeights;    // Heights the horizons were computed from
+	Vector3D shadedSun;      // Sun direction the sunVisibility terms were computed for
 	
 	GLfloat mat_ambient[4];
     GLfloat mat_specular[4];
@@ -44,8 +80,19 @@ typedef struct
 QuadMesh NewQuadMesh(int maxMeshSize);
 void SetMaterialQM(QuadMesh* qm, Vector3D ambient, Vector3D diffuse, Vector3D specular, double shininess);
 bool CreateMemoryQM(QuadMesh* qm);
+bool ResizeMeshQM(QuadMesh* qm, int maxMeshSize);
 bool InitMeshQM(QuadMesh* qm, int meshSize, Vector3D origin, double meshLength, double meshWidth, Vector3D dir1, Vector3D dir2);
 void DrawMeshQM(QuadMesh* qm, int meshSize);
 void FreeMemoryQM(QuadMesh* qm);
-void UpdateMesh(QuadMesh* qm, std::vector<Metaball> bloblist);
-void ComputeNormalsQM(QuadMesh* qm);
\ No newline at end of file
+void UpdateMesh(QuadMesh* qm, const std::vector<Metaball>& blobList);
+void ComputeNormalsQM(QuadMesh* qm);
+float EvaluateHeightQM(const std::vector<Metaball>& blobList, float x, float z);
+// Both grow *changed (unless NULL) to cover every vertex whose height they rewrote.
+void BeginProgressiveQM(QuadMesh* qm, const std::vector<Metaball>& blobList, double budgetMs, MeshRect* changed);
+bool RefineMeshQM(QuadMesh* qm, const std::vector<Metaball>& blobList, double budgetMs, MeshRect* changed);
+
+MeshRect EmptyRectQM();
+MeshRect FullRectQM(const QuadMesh* qm);
+void IncludeRectQM(MeshRect* rect, const MeshRect* other);
+
+#endif	//QUADMESH_H
@@ -0,0 +1,406 @@
+#include <string.h>
+#include <errno.h>
+#include <atomic>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <signal.h>
+#endif
+
+#include "SharedTerrain.h"
+
+#ifndef _WIN32
+
+static const uint32_t sharedMagic = 0x4E525254;    // "TRRN"
+static const uint32_t layoutVersion = 2;
+static const size_t alignment = 64;
+static const int readAttempts = 64;                 // BeginReadSharedTerrain spins at most this often
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "shared counters must be lock-free");
+
+// One copy of the grid. Everything but the sequence is only meaningful while it is even.
+typedef struct alignas(64) SharedBuffer
+{
+	std::atomic<uint64_t> sequence;   // odd while the writer is filling the buffer
+	uint64_t epoch;
+	int32_t meshSize;                 // 0 until the first publication into this buffer
+	float originX, originZ;
+	float stepX, stepZ;
+	int32_t dirty[4];                 // c0, r0, c1, r1 changed since the previous publication
+	uint64_t heightsOffset;           // from the start of the segment
+	uint64_t normalsOffset;
+} SharedBuffer;
+
+typedef struct SharedHeader
+{
+	std::atomic<uint32_t> magic;      // written last when the segment is set up
+	uint32_t version;
+	int32_t capacity;
+	int32_t writerPid;                // process that publishes into the segment
+	std::atomic<uint32_t> active;     // buffer holding the latest publication
+	std::atomic<uint32_t> retired;    // set once a larger segment has replaced this one
+	SharedBuffer buffers[2];
+} SharedHeader;
+
+static size_t AlignUp(size_t n)
+{
+	return (n + alignment - 1) / alignment * alignment;
+}
+
+static size_t SegmentBytes(int capacity)
+{
+	const size_t count = (size_t)(capacity + 1) * (capacity + 1);
+	return AlignUp(sizeof(SharedHeader)) + 2 * (AlignUp(count * sizeof(float)) + AlignUp(count * sizeof(Vector3D)));
+}
+
+// Normals depend on the neighbouring heights, so they change one sample further out.
+static void Grow(MeshRect* rect, int last)
+{
+	if (rect->c0 > rect->c1)
+		return;
+	rect->c0 = rect->c0 > 0 ? rect->c0 - 1 : 0;
+	rect->r0 = rect->r0 > 0 ? rect->r0 - 1 : 0;
+	rect->c1 = rect->c1 < last ? rect->c1 + 1 : last;
+	rect->r1 = rect->r1 < last ? rect->r1 + 1 : last;
+}
+
+static bool CreateSegment(SharedTerrainWriter* writer, int capacity)
+{
+	const size_t bytes = SegmentBytes(capacity);
+	int fd = shm_open(writer->name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0)
+		return false;
+	void* base = (ftruncate(fd, (off_t)bytes) == 0)
+		? mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (base == MAP_FAILED)
+	{
+		shm_unlink(writer->name);
+		return false;
+	}
+
+	// The segment starts out zeroed: no buffer has been published yet
+	SharedHeader* header = (SharedHeader*)base;
+	const size_t count = (size_t)(capacity + 1) * (capacity + 1);
+	size_t at = AlignUp(sizeof(SharedHeader));
+	header->version = layoutVersion;
+	header->capacity = capacity;
+	header->writerPid = (int32_t)getpid();
+	for (int b = 0; b < 2; b++)
+	{
+		header->buffers[b].heightsOffset = at;
+		at += AlignUp(count * sizeof(float));
+		header->buffers[b].normalsOffset = at;
+		at += AlignUp(count * sizeof(Vector3D));
+	}
+	header->magic.store(sharedMagic, std::memory_order_release);
+
+	writer->base = base;
+	writer->bytes = bytes;
+	writer->capacity = capacity;
+	return true;
+}
+
+static void RetireSegment(void* base, size_t bytes)
+{
+	((SharedHeader*)base)->retired.store(1, std::memory_order_release);
+	munmap(base, bytes);
+}
+
+// A segment left behind by an editor that did not shut down is retired, so its readers
+// move on to the new one. Returns false, leaving the segment alone, if the process that
+// created it is still running.
+static bool RetireStaleSegment(const char* name)
+{
+	int fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0)
+		return true;
+	struct stat st;
+	void* base = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(SharedHeader))
+		base = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (base != MAP_FAILED)
+	{
+		// Segments of other layouts or still being set up have no trustworthy pid
+		const SharedHeader* header = (const SharedHeader*)base;
+		const pid_t pid = header->version == layoutVersion ? (pid_t)header->writerPid : 0;
+		if (pid > 0 && pid != getpid() && (kill(pid, 0) == 0 || errno == EPERM))
+		{
+			munmap(base, (size_t)st.st_size);
+			return false;
+		}
+		RetireSegment(base, (size_t)st.st_size);
+	}
+	shm_unlink(name);
+	return true;
+}
+
+bool CreateSharedTerrain(SharedTerrainWriter* writer, const char* name, int capacity)
+{
+	strncpy(writer->name, name, sizeof(writer->name) - 1);
+	writer->name[sizeof(writer->name) - 1] = '\0';
+	writer->base = NULL;
+	writer->bytes = 0;
+	writer->capacity = 0;
+	writer->epoch = 0;
+
+	if (!RetireStaleSegment(writer->name))
+		return false;
+	return CreateSegment(writer, capacity < 1 ? 1 : capacity);
+}
+
+static bool SameGrid(const SharedBuffer* buf, int meshSize, float originX, float originZ, float stepX, float stepZ)
+{
+	return buf->meshSize == meshSize && buf->originX == originX && buf->originZ == originZ
+		&& buf->stepX == stepX && buf->stepZ == stepZ;
+}
+
+static void CopyRect(const QuadMesh* qm, const MeshRect* rect, float* heights, Vector3D* normals)
+{
+	const int rowLen = qm->meshSize + 1;
+	for (int r = rect->r0; r <= rect->r1; r++)
+	{
+		for (int c = rect->c0; c <= rect->c1; c++)
+		{
+			const int idx = r * rowLen + c;
+			heights[idx] = qm->vertices[idx].position.y;
+			normals[idx] = qm->vertices[idx].normal;
+		}
+	}
+}
+
+// Bring the inactive buffer up to date with the mesh and make it the active one. The
+// buffer was last written two publications ago, so it only needs the rectangle the
+// previous publication changed plus the one changed since.
+static void PublishToSegment(SharedTerrainWriter* writer, const QuadMesh* qm, const MeshRect* changedHeights)
+{
+	char* base = (char*)writer->base;
+	SharedHeader* header = (SharedHeader*)base;
+	const uint32_t b = 1 - header->active.load(std::memory_order_relaxed);
+	SharedBuffer* buf = &header->buffers[b];
+	const SharedBuffer* prev = &header->buffers[1 - b];
+	float* heights = (float*)(base + buf->heightsOffset);
+	Vector3D* normals = (Vector3D*)(base + buf->normalsOffset);
+
+	const int last = qm->meshSize;
+	const float originX = qm->originX;
+	const float originZ = qm->originZ;
+	const float stepX = qm->stepX;
+	const float stepZ = qm->stepZ;
+
+	// 'changed' is what readers of the previous publication need to refresh, 'missed' is
+	// what the previous publication changed in the other buffer. They are copied one after
+	// the other rather than as their bounding rectangle, which for two far apart edits
+	// would be most of the grid.
+	const MeshRect full = FullRectQM(qm);
+	const bool prevSame = SameGrid(prev, last, originX, originZ, stepX, stepZ);
+	const bool bufSame = prevSame && SameGrid(buf, last, originX, originZ, stepX, stepZ)
+		&& buf->epoch + 1 == prev->epoch;
+	MeshRect changed = (changedHeights != NULL && prevSame) ? *changedHeights : full;
+	if (changed.c0 > changed.c1)
+		return;     // the active buffer already matches the mesh
+	Grow(&changed, last);
+	MeshRect missed = { prev->dirty[0], prev->dirty[1], prev->dirty[2], prev->dirty[3] };
+	if (!bufSame)
+		missed = full;
+
+	const uint64_t sequence = buf->sequence.load(std::memory_order_relaxed);
+	buf->sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	buf->epoch = ++writer->epoch;
+	buf->meshSize = last;
+	buf->originX = originX;
+	buf->originZ = originZ;
+	buf->stepX = stepX;
+	buf->stepZ = stepZ;
+	buf->dirty[0] = changed.c0;
+	buf->dirty[1] = changed.r0;
+	buf->dirty[2] = changed.c1;
+	buf->dirty[3] = changed.r1;
+	CopyRect(qm, &missed, heights, normals);
+	if (changed.c0 < missed.c0 || changed.r0 < missed.r0 || changed.c1 > missed.c1 || changed.r1 > missed.r1)
+		CopyRect(qm, &changed, heights, normals);
+
+	buf->sequence.store(sequence + 2, std::memory_order_release);
+	header->active.store(b, std::memory_order_release);
+}
+
+bool PublishSharedTerrainQM(SharedTerrainWriter* writer, const QuadMesh* qm, const MeshRect* changed)
+{
+	if (writer->base == NULL || qm->meshSize < 1)
+		return false;
+
+	if (qm->meshSize > writer->capacity)
+	{
+		// Replace the segment with a larger one and only retire the old one once the
+		// new one holds the mesh, so readers that switch over find something to read
+		void* oldBase = writer->base;
+		size_t oldBytes = writer->bytes;
+		shm_unlink(writer->name);
+		if (!CreateSegment(writer, qm->meshSize))
+		{
+			writer->base = NULL;
+			RetireSegment(oldBase, oldBytes);
+			return false;
+		}
+		PublishToSegment(writer, qm, NULL);
+		RetireSegment(oldBase, oldBytes);
+		return true;
+	}
+
+	PublishToSegment(writer, qm, changed);
+	return true;
+}
+
+void DestroySharedTerrain(SharedTerrainWriter* writer)
+{
+	// Readers keep their mapping, and with it the last publication, but are told it is
+	// retired so they pick up the segment of the next editor under this name
+	if (writer->base != NULL)
+	{
+		RetireSegment(writer->base, writer->bytes);
+		shm_unlink(writer->name);
+	}
+	writer->base = NULL;
+	writer->bytes = 0;
+}
+
+static bool MapReader(SharedTerrainReader* reader)
+{
+	int fd = shm_open(reader->name, O_RDONLY, 0);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	void* base = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(SharedHeader))
+		base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return false;
+
+	// The writer may still be setting the segment up
+	const SharedHeader* header = (const SharedHeader*)base;
+	if (header->magic.load(std::memory_order_acquire) != sharedMagic || header->version != layoutVersion
+		|| SegmentBytes(header->capacity) > (size_t)st.st_size)
+	{
+		munmap(base, (size_t)st.st_size);
+		return false;
+	}
+	reader->base = base;
+	reader->bytes = (size_t)st.st_size;
+	return true;
+}
+
+bool OpenSharedTerrain(SharedTerrainReader* reader, const char* name)
+{
+	strncpy(reader->name, name, sizeof(reader->name) - 1);
+	reader->name[sizeof(reader->name) - 1] = '\0';
+	reader->base = NULL;
+	reader->bytes = 0;
+	MapReader(reader);
+	return true;
+}
+
+bool BeginReadSharedTerrain(SharedTerrainReader* reader, SharedTerrainView* view)
+{
+	// Mapping calls only happen before the first publication and after the writer
+	// replaced the segment; every other read is plain loads from the mapping
+	if (reader->base != NULL && ((const SharedHeader*)reader->base)->retired.load(std::memory_order_acquire))
+		CloseSharedTerrain(reader);
+	if (reader->base == NULL && !MapReader(reader))
+		return false;
+
+	const char* base = (const char*)reader->base;
+	const SharedHeader* header = (const SharedHeader*)base;
+	for (int attempt = 0; attempt < readAttempts; attempt++)
+	{
+		const uint32_t b = header->active.load(std::memory_order_acquire);
+		const SharedBuffer* buf = &header->buffers[b];
+		const uint64_t sequence = buf->sequence.load(std::memory_order_acquire);
+		if (sequence & 1)
+			continue;
+
+		view->epoch = buf->epoch;
+		view->meshSize = buf->meshSize;
+		view->originX = buf->originX;
+		view->originZ = buf->originZ;
+		view->stepX = buf->stepX;
+		view->stepZ = buf->stepZ;
+		view->dirtyC0 = buf->dirty[0];
+		view->dirtyR0 = buf->dirty[1];
+		view->dirtyC1 = buf->dirty[2];
+		view->dirtyR1 = buf->dirty[3];
+		view->heights = (const float*)(base + buf->heightsOffset);
+		view->normals = (const Vector3D*)(base + buf->normalsOffset);
+		view->buffer = (int)b;
+		view->sequence = sequence;
+
+		// The header fields must be consistent before the caller indexes with them
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (buf->sequence.load(std::memory_order_relaxed) != sequence)
+			continue;
+		return view->meshSize > 0 && view->meshSize <= header->capacity;
+	}
+	return false;
+}
+
+bool EndReadSharedTerrain(const SharedTerrainReader* reader, const SharedTerrainView* view)
+{
+	const SharedHeader* header = (const SharedHeader*)reader->base;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return header->buffers[view->buffer].sequence.load(std::memory_order_relaxed) == view->sequence;
+}
+
+void CloseSharedTerrain(SharedTerrainReader* reader)
+{
+	if (reader->base != NULL)
+		munmap((void*)reader->base, reader->bytes);
+	reader->base = NULL;
+	reader->bytes = 0;
+}
+
+#else
+
+// Shared terrain relies on POSIX shared memory and is not available on Windows.
+bool CreateSharedTerrain(SharedTerrainWriter* writer, const char* name, int capacity)
+{
+	writer->base = NULL;
+	return false;
+}
+
+bool PublishSharedTerrainQM(SharedTerrainWriter* writer, const QuadMesh* qm, const MeshRect* changed)
+{
+	return false;
+}
+
+void DestroySharedTerrain(SharedTerrainWriter* writer)
+{
+}
+
+bool OpenSharedTerrain(SharedTerrainReader* reader, const char* name)
+{
+	reader->base = NULL;
+	return false;
+}
+
+bool BeginReadSharedTerrain(SharedTerrainReader* reader, SharedTerrainView* view)
+{
+	return false;
+}
+
+bool EndReadSharedTerrain(const SharedTerrainReader* reader, const SharedTerrainView* view)
+{
+	return false;
+}
+
+void CloseSharedTerrain(SharedTerrainReader* reader)
+{
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef SHAREDTERRAIN_H
+#define SHAREDTERRAIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "QuadMesh.h"
+
+// Live publication of the height grid to other processes through POSIX shared memory.
+//
+// The editor owns a writer and publishes its mesh after every change; analysis or
+// visualization processes open a reader on the same name and sample the heights and
+// normals straight from the mapping, without copies and without system calls per frame.
+//
+// The segment holds two buffers, each guarded by its own sequence counter (a seqlock
+// that is odd while the buffer is being written). A publication fills the buffer readers
+// are not pointed at, then makes it the active one, so a reader is only disturbed if two
+// more publications happen while it is still reading. The writer passes the rectangle of
+// heights it changed since its previous publication; a buffer is brought up to date by
+// rewriting that rectangle and the one of the publication it missed, and readers are told
+// the rectangle that changed since the previous publication.
+//
+// There is one writer per segment. Creating a segment replaces one left behind by a
+// writer that died, but fails while the writer that created it is still running. When
+// the mesh grows beyond the capacity of the segment the writer retires it and creates a
+// larger one under the same name; readers notice and remap on their next read. The
+// Windows build has no shared terrain and every call fails.
+
+typedef struct SharedTerrainWriter
+{
+	char name[64];
+	int capacity;                  // largest meshSize the segment holds
+	void* base;                    // writable mapping, NULL when closed
+	size_t bytes;
+	unsigned long long epoch;      // last publication
+} SharedTerrainWriter;
+
+typedef struct SharedTerrainReader
+{
+	char name[64];
+	const void* base;              // read-only mapping, NULL until the segment exists
+	size_t bytes;
+} SharedTerrainReader;
+
+// One consistent publication, pointing into the mapping. Only valid until the matching
+// EndReadSharedTerrain call returns.
+typedef struct SharedTerrainView
+{
+	unsigned long long epoch;
+	int meshSize;                  // quads per side; the grid has meshSize + 1 samples per side
+	float originX, originZ;        // world position of sample (0, 0)
+	float stepX, stepZ;            // world distance between neighbouring columns / rows
+	int dirtyC0, dirtyR0;          // inclusive rectangle of the samples changed since epoch - 1
+	int dirtyC1, dirtyR1;
+	const float* heights;          // row-major
+	const Vector3D* normals;       // row-major
+
+	int buffer;                    // used by EndReadSharedTerrain
+	uint64_t sequence;
+} SharedTerrainView;
+
+// Editor side.
+bool CreateSharedTerrain(SharedTerrainWriter* writer, const char* name, int capacity);
+// 'changed' must cover every height changed since the previous call; NULL means all of them.
+bool PublishSharedTerrainQM(SharedTerrainWriter* writer, const QuadMesh* qm, const MeshRect* changed);
+void DestroySharedTerrain(SharedTerrainWriter* writer);     // also removes the name
+
+// Reader side. OpenSharedTerrain succeeds even if the writer has not created the segment
+// yet; BeginReadSharedTerrain returns false until there is a publication to read.
+bool OpenSharedTerrain(SharedTerrainReader* reader, const char* name);
+bool BeginReadSharedTerrain(SharedTerrainReader* reader, SharedTerrainView* view);
+bool EndReadSharedTerrain(const SharedTerrainReader* reader, const SharedTerrainView* view);   // false if the view was overwritten
+void CloseSharedTerrain(SharedTerrainReader* reader);
+
+#endif	//SHAREDTERRAIN_H
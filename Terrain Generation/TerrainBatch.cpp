@@ -0,0 +1,427 @@
+// Batch terrain generator.
+//
+// Reads scene descriptions listing metaballs, builds each terrain with the same QuadMesh
+// code as the interactive editor and writes a 16-bit heightmap plus an RGB normal map.
+// Scenes are processed concurrently by a pool of worker threads fed through a bounded
+// queue; every worker keeps its own mesh buffers and reuses them between scenes. With
+// -workers, scenes are generated one at a time instead, each split into tiles that are
+// handed to a pool of worker processes (see TileService.h).
+//
+// Scene file format (one or more scenes per file, '#' starts a comment):
+//
+//	scene hills01               name used for the output files (no '/', '\' or '..')
+//	mesh 256 32 32              quads per side, width (x) and length (z) of the terrain
+//	range -10 10                optional fixed height range for the heightmap
+//	blob 12.5 -8.0 0.1 5.0      x z width height (same meaning as in the editor)
+//	end
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+
+#include "QuadMesh.h"
+#include "ImageWriter.h"
+#include "Benchmarks.h"
+#include "FastGauss.h"
+#include "TileService.h"
+
+// Same cap as the editor; far larger sizes overflow the int vertex counts
+const int maxMeshSize = 8192;
+
+typedef struct Scene
+{
+	std::string name;
+	int meshSize;
+	float meshWidth;
+	float meshLength;
+	bool autoRange;
+	float rangeLow;
+	float rangeHigh;
+	std::vector<Metaball> blobs;
+} Scene;
+
+typedef struct BatchOptions
+{
+	int jobs;
+	std::string outDir;
+	bool rawHeights;
+	bool normalMaps;
+	bool quiet;
+	double fgtTolerance;     // 0 for exact evaluation
+	TileService* tiles;      // worker processes, NULL to evaluate in the thread
+} BatchOptions;
+
+// Fixed-capacity queue between the scene reader and the workers.
+class SceneQueue
+{
+public:
+	explicit SceneQueue(size_t capacity) : capacity(capacity), closed(false) {}
+
+	void Push(Scene scene)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		notFull.wait(lock, [this] { return scenes.size() < capacity; });
+		scenes.push_back(std::move(scene));
+		notEmpty.notify_one();
+	}
+
+	// Returns false once the queue is closed and drained.
+	bool Pop(Scene* scene)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		notEmpty.wait(lock, [this] { return !scenes.empty() || closed; });
+		if (scenes.empty())
+			return false;
+		*scene = std::move(scenes.front());
+		scenes.pop_front();
+		notFull.notify_one();
+		return true;
+	}
+
+	void Close()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		closed = true;
+		notEmpty.notify_all();
+	}
+
+private:
+	size_t capacity;
+	bool closed;
+	std::deque<Scene> scenes;
+	std::mutex mutex;
+	std::condition_variable notEmpty;
+	std::condition_variable notFull;
+};
+
+static std::atomic<int> scenesDone(0);
+static std::atomic<int> scenesFailed(0);
+
+static void DefaultScene(Scene* scene)
+{
+	scene->name.clear();
+	scene->meshSize = 48;
+	scene->meshWidth = 32;
+	scene->meshLength = 32;
+	scene->autoRange = true;
+	scene->rangeLow = 0;
+	scene->rangeHigh = 0;
+	scene->blobs.clear();
+}
+
+// Scene names become file names inside the output directory, so they may not leave it.
+static bool ValidSceneName(const char* name)
+{
+	return strchr(name, '/') == NULL && strchr(name, '\\') == NULL && strstr(name, "..") == NULL;
+}
+
+// Parses every scene in the file and hands it to the queue. Returns false on a syntax error.
+static bool ReadSceneFile(const char* path, SceneQueue* queue)
+{
+	FILE* fp = fopen(path, "r");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "%s: cannot open\n", path);
+		return false;
+	}
+
+	Scene scene;
+	DefaultScene(&scene);
+	bool inScene = false;
+	bool ok = true;
+	char line[512];
+	int lineNo = 0;
+
+	while (ok && fgets(line, sizeof(line), fp) != NULL)
+	{
+		lineNo++;
+		char* hash = strchr(line, '#');
+		if (hash != NULL)
+			*hash = '\0';
+
+		char keyword[32], name[256];
+		Metaball blob;
+		float x, z, width, height;
+		if (sscanf(line, "%31s", keyword) != 1)
+			continue;
+
+		if (strcmp(keyword, "scene") == 0 && sscanf(line, "%*s %255s", name) == 1)
+		{
+			if (!ValidSceneName(name))
+			{
+				fprintf(stderr, "%s:%d: invalid scene name %s\n", path, lineNo, name);
+				fclose(fp);
+				return false;
+			}
+			DefaultScene(&scene);
+			scene.name = name;
+			inScene = true;
+		}
+		else if (!inScene)
+		{
+			ok = false;
+		}
+		else if (strcmp(keyword, "mesh") == 0)
+		{
+			ok = sscanf(line, "%*s %d %f %f", &scene.meshSize, &scene.meshWidth, &scene.meshLength) == 3
+				&& scene.meshSize > 0 && scene.meshSize <= maxMeshSize && scene.meshWidth > 0 && scene.meshLength > 0;
+		}
+		else if (strcmp(keyword, "range") == 0)
+		{
+			ok = sscanf(line, "%*s %f %f", &scene.rangeLow, &scene.rangeHigh) == 2 && scene.rangeHigh > scene.rangeLow;
+			scene.autoRange = false;
+		}
+		else if (strcmp(keyword, "blob") == 0)
+		{
+			ok = sscanf(line, "%*s %f %f %f %f", &x, &z, &width, &height) == 4 && width > 0;
+			blob.pos = NewVector3D(x, 0, z);
+			blob.width = width;
+			blob.height = height;
+			scene.blobs.push_back(blob);
+		}
+		else if (strcmp(keyword, "end") == 0)
+		{
+			queue->Push(std::move(scene));
+			DefaultScene(&scene);
+			inScene = false;
+		}
+		else
+		{
+			ok = false;
+		}
+	}
+	fclose(fp);
+
+	if (ok && inScene)
+	{
+		fprintf(stderr, "%s: missing 'end' for scene %s\n", path, scene.name.c_str());
+		return false;
+	}
+	if (!ok)
+		fprintf(stderr, "%s:%d: syntax error\n", path, lineNo);
+	return ok;
+}
+
+static bool WriteScene(const Scene& scene, const QuadMesh& qm, const BatchOptions& options,
+	std::vector<uint16_t>& heights, std::vector<uint8_t>& normals)
+{
+	const int side = scene.meshSize + 1;
+	const int count = side * side;
+
+	float lo = scene.rangeLow, hi = scene.rangeHigh;
+	if (scene.autoRange)
+	{
+		lo = hi = qm.vertices[0].position.y;
+		for (int i = 1; i < count; i++)
+		{
+			float y = qm.vertices[i].position.y;
+			lo = y < lo ? y : lo;
+			hi = y > hi ? y : hi;
+		}
+		if (hi <= lo)
+			hi = lo + 1;
+	}
+
+	heights.resize(count);
+	for (int i = 0; i < count; i++)
+	{
+		float t = (qm.vertices[i].position.y - lo) / (hi - lo);
+		t = t < 0 ? 0 : (t > 1 ? 1 : t);
+		heights[i] = (uint16_t)(t * 65535.0f + 0.5f);
+	}
+
+	std::string base = options.outDir + "/" + scene.name;
+	bool ok = options.rawHeights
+		? WriteRaw16((base + "_height.r16").c_str(), side, side, heights.data())
+		: WritePNG16Gray((base + "_height.png").c_str(), side, side, heights.data());
+
+	if (ok && options.normalMaps)
+	{
+		// World-space normals, x/y/z mapped from [-1,1] to RGB
+		normals.resize(count * 3);
+		for (int i = 0; i < count; i++)
+		{
+			const Vector3D& n = qm.vertices[i].normal;
+			normals[3 * i + 0] = (uint8_t)((n.x * 0.5f + 0.5f) * 255.0f + 0.5f);
+			normals[3 * i + 1] = (uint8_t)((n.y * 0.5f + 0.5f) * 255.0f + 0.5f);
+			normals[3 * i + 2] = (uint8_t)((n.z * 0.5f + 0.5f) * 255.0f + 0.5f);
+		}
+		ok = WritePNG8RGB((base + "_normal.png").c_str(), side, side, normals.data());
+	}
+
+	if (!options.quiet)
+		printf("%s: %dx%d, %d blobs, heights [%.3f, %.3f]\n", scene.name.c_str(), side, side, (int)scene.blobs.size(), lo, hi);
+	return ok;
+}
+
+static void Worker(SceneQueue* queue, const BatchOptions* options)
+{
+	// Mesh and image buffers are kept across scenes and only grow
+	QuadMesh qm = NewQuadMesh(48);
+	std::vector<uint16_t> heights;
+	std::vector<uint8_t> normals;
+	Scene scene;
+
+	Vector3D origin = NewVector3D(0.0f, 0.0f, 0.0f);
+	Vector3D dir1v = NewVector3D(1.0f, 0.0f, 0.0f);
+	Vector3D dir2v = NewVector3D(0.0f, 0.0f, -1.0f);
+
+	while (queue->Pop(&scene))
+	{
+		if (scene.meshSize > qm.maxMeshSize)
+		{
+			FreeMemoryQM(&qm);
+			qm = NewQuadMesh(scene.meshSize);
+		}
+
+		bool ok = InitMeshQM(&qm, scene.meshSize, origin, scene.meshWidth, scene.meshLength, dir1v, dir2v);
+		if (ok)
+		{
+			TileServiceReport report;
+			if (options->tiles != NULL)
+				ok = GenerateTilesQM(options->tiles, &qm, scene.blobs, &report);
+			else if (options->fgtTolerance > 0)
+				UpdateMeshFGT(&qm, scene.blobs, options->fgtTolerance, NULL);
+			else
+				UpdateMesh(&qm, scene.blobs);
+
+			if (ok && options->tiles != NULL && !options->quiet)
+				printf("%s: %d tiles, %d retried, %d worker failures, %.1f blobs/tile\n", scene.name.c_str(),
+					report.tiles, report.retries, report.workerFailures, (double)report.blobsSent / report.tiles);
+			ok = ok && WriteScene(scene, qm, *options, heights, normals);
+		}
+		if (!ok)
+		{
+			fprintf(stderr, "%s: failed to generate\n", scene.name.c_str());
+			scenesFailed++;
+		}
+		scenesDone++;
+	}
+
+	FreeMemoryQM(&qm);
+}
+
+static void PrintUsage()
+{
+	printf("Usage: TerrainBatch [options] scene-file...\n");
+	printf("  -j N        worker threads (default: hardware threads)\n");
+	printf("  -o DIR      output directory (default: .)\n");
+	printf("  -raw        write heights as little-endian .r16 instead of 16-bit PNG\n");
+	printf("  -nonormals  skip the normal maps\n");
+	printf("  -q          only print the summary\n");
+	printf("  -fgt TOL    evaluate with the Fast Gauss Transform to within TOL (not with -workers)\n");
+	printf("  -workers N  split each scene into tiles generated by N worker processes (Linux)\n");
+	printf("  -tile N     vertices per tile side with -workers (default: 128)\n");
+	printf("  -failrate P make workers crash on a fraction P of tiles, to test retries\n");
+	printf("  -bench      run the microbenchmarks instead\n");
+}
+
+int main(int argc, char** argv)
+{
+	BatchOptions options;
+	options.jobs = (int)std::thread::hardware_concurrency();
+	options.outDir = ".";
+	options.rawHeights = false;
+	options.normalMaps = true;
+	options.quiet = false;
+	options.fgtTolerance = 0;
+	options.tiles = NULL;
+
+	TileServiceOptions tileOptions;
+	DefaultTileServiceOptions(&tileOptions);
+	tileOptions.workers = 0;
+
+	std::vector<const char*> files;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			options.jobs = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+			options.outDir = argv[++i];
+		else if (strcmp(argv[i], "-raw") == 0)
+			options.rawHeights = true;
+		else if (strcmp(argv[i], "-nonormals") == 0)
+			options.normalMaps = false;
+		else if (strcmp(argv[i], "-q") == 0)
+			options.quiet = true;
+		else if (strcmp(argv[i], "-fgt") == 0 && i + 1 < argc)
+			options.fgtTolerance = atof(argv[++i]);
+		else if (strcmp(argv[i], "-workers") == 0 && i + 1 < argc)
+			tileOptions.workers = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-tile") == 0 && i + 1 < argc)
+			tileOptions.tileSize = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-failrate") == 0 && i + 1 < argc)
+			tileOptions.failRate = atof(argv[++i]);
+		else if (strcmp(argv[i], "-bench") == 0)
+			return RunVectorBenchmarks() && RunProgressiveBenchmarks() && RunQueryBenchmarks() && RunFGTBenchmarks() && RunOcclusionBenchmarks()
+				&& RunSharedTerrainBenchmarks() && RunTileServiceBenchmarks() ? 0 : 1;
+		else if (argv[i][0] == '-')
+		{
+			PrintUsage();
+			return 1;
+		}
+		else
+			files.push_back(argv[i]);
+	}
+	if (files.empty())
+	{
+		PrintUsage();
+		return 1;
+	}
+	if (options.jobs < 1)
+		options.jobs = 1;
+	if (options.fgtTolerance > 0 && tileOptions.workers > 0)
+	{
+		fprintf(stderr, "-fgt cannot be combined with -workers\n");
+		return 1;
+	}
+
+	// The tile service forks its spawner before any thread starts, and one scene at a
+	// time is split across the worker processes
+	TileService tileService;
+	if (tileOptions.workers > 0)
+	{
+		if (!StartTileService(&tileService, &tileOptions))
+		{
+			fprintf(stderr, "cannot start %d tile workers\n", tileOptions.workers);
+			return 1;
+		}
+		options.tiles = &tileService;
+		options.jobs = 1;
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// Keep a couple of scenes per worker in flight so the reader never runs far ahead
+	SceneQueue queue(2 * options.jobs);
+	std::vector<std::thread> workers;
+	for (int i = 0; i < options.jobs; i++)
+		workers.push_back(std::thread(Worker, &queue, &options));
+
+	bool readOk = true;
+	for (size_t i = 0; i < files.size(); i++)
+		readOk = ReadSceneFile(files[i], &queue) && readOk;
+	queue.Close();
+
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+	if (options.tiles != NULL)
+		StopTileService(options.tiles);
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("%d scenes (%d failed) in %.3f s with %d %s: %.1f scenes/sec\n", scenesDone.load(), scenesFailed.load(), seconds,
+		options.tiles != NULL ? tileOptions.workers : options.jobs, options.tiles != NULL ? "worker processes" : "threads",
+		seconds > 0 ? scenesDone / seconds : 0.0);
+
+	return (readOk && scenesFailed == 0) ? 0 : 1;
+}
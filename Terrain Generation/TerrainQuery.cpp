@@ -0,0 +1,249 @@
+#include <math.h>
+#include <atomic>
+#include <mutex>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "TerrainQuery.h"
+#include "TerrainQueryAVX2.h"
+
+static TerrainSnapshotRef currentSnapshot;
+static std::shared_ptr<TerrainSnapshot> retiredSnapshot;    // reused once no reader holds it
+static std::mutex publishMutex;
+static unsigned long long lastEpoch = 0;
+
+void PublishTerrainQM(const QuadMesh* qm, const std::vector<Metaball>& blobList)
+{
+	std::lock_guard<std::mutex> lock(publishMutex);
+
+	// Readers can only reach the retired snapshot through references they already hold,
+	// so once the count drops to ours its storage can be refilled. use_count() is a relaxed
+	// load; the fence orders the last reader's accesses before our writes.
+	std::shared_ptr<TerrainSnapshot> snapshot;
+	if (retiredSnapshot && retiredSnapshot.use_count() == 1)
+	{
+		std::atomic_thread_fence(std::memory_order_acquire);
+		snapshot.swap(retiredSnapshot);
+	}
+	else
+		snapshot = std::make_shared<TerrainSnapshot>();
+
+	const int rowLen = qm->meshSize + 1;
+	const int count = rowLen * rowLen;
+	snapshot->epoch = ++lastEpoch;
+	snapshot->meshSize = qm->meshSize;
+	snapshot->originX = qm->originX;
+	snapshot->originZ = qm->originZ;
+	snapshot->stepX = qm->stepX;
+	snapshot->stepZ = qm->stepZ;
+	snapshot->heights.resize(count);
+	snapshot->normals.resize(count);
+	for (int i = 0; i < count; i++)
+	{
+		snapshot->heights[i] = qm->vertices[i].position.y;
+		snapshot->normals[i] = qm->vertices[i].normal;
+	}
+	snapshot->blobs = blobList;
+
+	TerrainSnapshotRef previous = std::atomic_exchange(&currentSnapshot, TerrainSnapshotRef(snapshot));
+	retiredSnapshot = std::const_pointer_cast<TerrainSnapshot>(previous);
+}
+
+TerrainSnapshotRef AcquireTerrainSnapshot()
+{
+	return std::atomic_load(&currentSnapshot);
+}
+
+// Height and normal of the metaball field itself, for points off the grid.
+static void SampleField(const TerrainSnapshot* s, float x, float z, float* height, Vector3D* normal)
+{
+	double h = 0, dhdx = 0, dhdz = 0;
+	for (size_t k = 0; k < s->blobs.size(); k++)
+	{
+		const Metaball& b = s->blobs[k];
+		double dx = b.pos.x - x, dy = b.pos.y, dz = b.pos.z - z;
+		double term = b.height * exp(-(b.width * (dx*dx + dy*dy + dz*dz)));
+		h += term;
+		dhdx += 2 * b.width * dx * term;
+		dhdz += 2 * b.width * dz * term;
+	}
+	*height = (float)h;
+	if (normal != NULL)
+	{
+		Set(normal, (float)-dhdx, 1.0f, (float)-dhdz);
+		Normalize(normal);
+	}
+}
+
+static void SampleBilinear(const TerrainSnapshot* s, int i, int j, float fu, float fv, float* height, Vector3D* normal)
+{
+	const int rowLen = s->meshSize + 1;
+	const int k = j * rowLen + i;
+	const float w00 = (1 - fu) * (1 - fv), w01 = fu * (1 - fv), w10 = (1 - fu) * fv, w11 = fu * fv;
+
+	*height = w00 * s->heights[k] + w01 * s->heights[k + 1]
+		+ w10 * s->heights[k + rowLen] + w11 * s->heights[k + rowLen + 1];
+	if (normal != NULL)
+	{
+		const Vector3D* n = &s->normals[k];
+		const Vector3D* m = &s->normals[k + rowLen];
+		Set(normal,
+			w00 * n[0].x + w01 * n[1].x + w10 * m[0].x + w11 * m[1].x,
+			w00 * n[0].y + w01 * n[1].y + w10 * m[0].y + w11 * m[1].y,
+			w00 * n[0].z + w01 * n[1].z + w10 * m[0].z + w11 * m[1].z);
+		Normalize(normal);
+	}
+}
+
+// Catmull-Rom weights for the samples at -1, 0, 1, 2 and their derivatives.
+static void CatmullRomWeights(float t, float w[4], float dw[4])
+{
+	const float t2 = t * t, t3 = t2 * t;
+	w[0] = 0.5f * (-t3 + 2 * t2 - t);
+	w[1] = 0.5f * (3 * t3 - 5 * t2 + 2);
+	w[2] = 0.5f * (-3 * t3 + 4 * t2 + t);
+	w[3] = 0.5f * (t3 - t2);
+	dw[0] = 0.5f * (-3 * t2 + 4 * t - 1);
+	dw[1] = 0.5f * (9 * t2 - 10 * t);
+	dw[2] = 0.5f * (-9 * t2 + 8 * t + 1);
+	dw[3] = 0.5f * (3 * t2 - 2 * t);
+}
+
+// Grid height with linear extrapolation one sample past each edge, so border cells keep
+// the accuracy of the interior instead of flattening out.
+static float PatchHeight(const TerrainSnapshot* s, int row, int col)
+{
+	const int last = s->meshSize;
+	if (row < 0)
+		return 2 * PatchHeight(s, 0, col) - PatchHeight(s, 1, col);
+	if (row > last)
+		return 2 * PatchHeight(s, last, col) - PatchHeight(s, last - 1, col);
+	const float* line = &s->heights[row * (last + 1)];
+	if (col < 0)
+		return 2 * line[0] - line[1];
+	if (col > last)
+		return 2 * line[last] - line[last - 1];
+	return line[col];
+}
+
+static void SampleBicubic(const TerrainSnapshot* s, int i, int j, float fu, float fv, float* height, Vector3D* normal)
+{
+	float wu[4], dwu[4], wv[4], dwv[4];
+	CatmullRomWeights(fu, wu, dwu);
+	CatmullRomWeights(fv, wv, dwv);
+
+	const bool interior = i > 0 && j > 0 && i + 2 <= s->meshSize && j + 2 <= s->meshSize;
+	float h = 0, dhdu = 0, dhdv = 0;
+	for (int r = 0; r < 4; r++)
+	{
+		const float* line = interior ? &s->heights[(j - 1 + r) * (s->meshSize + 1) + i - 1] : NULL;
+		float along = 0, alongDeriv = 0;
+		for (int c = 0; c < 4; c++)
+		{
+			float sample = interior ? line[c] : PatchHeight(s, j - 1 + r, i - 1 + c);
+			along += wu[c] * sample;
+			alongDeriv += dwu[c] * sample;
+		}
+		h += wv[r] * along;
+		dhdu += wv[r] * alongDeriv;
+		dhdv += dwv[r] * along;
+	}
+
+	*height = h;
+	if (normal != NULL)
+	{
+		Set(normal, -dhdu / s->stepX, 1.0f, -dhdv / s->stepZ);
+		Normalize(normal);
+	}
+}
+
+// Maps (x, z) to a grid cell and the position inside it. Returns false off the grid.
+static bool LocateCell(const TerrainSnapshot* s, float x, float z, int* i, int* j, float* fu, float* fv)
+{
+	const float u = (x - s->originX) / s->stepX;
+	const float v = (z - s->originZ) / s->stepZ;
+	if (!(u >= 0 && v >= 0 && u <= s->meshSize && v <= s->meshSize))
+		return false;
+
+	*i = (int)u < s->meshSize ? (int)u : s->meshSize - 1;
+	*j = (int)v < s->meshSize ? (int)v : s->meshSize - 1;
+	*fu = u - *i;
+	*fv = v - *j;
+	return true;
+}
+
+static void QueryOne(const TerrainSnapshot* s, float x, float z, TerrainFilter filter, float* height, Vector3D* normal)
+{
+	int i, j;
+	float fu, fv;
+	if (!LocateCell(s, x, z, &i, &j, &fu, &fv))
+		SampleField(s, x, z, height, normal);
+	else if (filter == TERRAIN_BICUBIC)
+		SampleBicubic(s, i, j, fu, fv, height, normal);
+	else
+		SampleBilinear(s, i, j, fu, fv, height, normal);
+}
+
+#ifdef TERRAIN_QUERY_AVX2
+
+// True when both the CPU and the OS (saved YMM state) support AVX2.
+static bool CpuHasAVX2()
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	__cpuid(info, 1);
+	const int osxsave = 1 << 27, avx = 1 << 28;
+	if ((info[2] & (osxsave | avx)) != (osxsave | avx) || (_xgetbv(0) & 6) != 6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+// Bilinear queries 8 points at a time with the AVX2 kernel. Points off the grid are
+// redone one at a time afterwards.
+static int QueryBilinear8(const TerrainSnapshot* s, const float* x, const float* z, int count, float* heights, Vector3D* normals)
+{
+	TerrainGridAVX2 grid;
+	grid.meshSize = s->meshSize;
+	grid.originX = s->originX;
+	grid.originZ = s->originZ;
+	grid.stepX = s->stepX;
+	grid.stepZ = s->stepZ;
+	grid.heights = s->heights.data();
+	grid.normals = &s->normals[0].x;
+
+	int p = 0;
+	for (; p + 8 <= count; p += 8)
+	{
+		int offGrid = QueryBilinear8AVX2(&grid, x + p, z + p, heights + p, normals != NULL ? &normals[p].x : NULL);
+		for (int l = 0; offGrid != 0; l++, offGrid >>= 1)
+		{
+			if (offGrid & 1)
+				SampleField(s, x[p + l], z[p + l], &heights[p + l], normals != NULL ? &normals[p + l] : NULL);
+		}
+	}
+	return p;
+}
+
+#endif
+
+void QueryTerrain(const TerrainSnapshot* snapshot, const float* x, const float* z, int count,
+	TerrainFilter filter, float* heights, Vector3D* normals)
+{
+	int p = 0;
+#ifdef TERRAIN_QUERY_AVX2
+	static const bool hasAVX2 = CpuHasAVX2();
+	if (filter == TERRAIN_BILINEAR && hasAVX2)
+		p = QueryBilinear8(snapshot, x, z, count, heights, normals);
+#endif
+	for (; p < count; p++)
+		QueryOne(snapshot, x[p], z[p], filter, &heights[p], normals != NULL ? &normals[p] : NULL);
+}
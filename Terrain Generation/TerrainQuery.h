@@ -0,0 +1,50 @@
+#ifndef TERRAINQUERY_H
+#define TERRAINQUERY_H
+
+#include <memory>
+#include <vector>
+#include "QuadMesh.h"
+
+// Height and normal queries at arbitrary world (x, z) points.
+//
+// Queries never read a QuadMesh directly. The thread that edits the mesh publishes an
+// immutable snapshot after each update (PublishTerrainQM), and query threads acquire the
+// current snapshot (AcquireTerrainSnapshot) and sample it for as long as they like, even
+// while the mesh is being updated again. Every snapshot carries an epoch that increases
+// with each publication so callers can tell when their copy is stale.
+//
+// Points outside the grid are answered by evaluating the metaball field the grid was
+// baked from.
+
+typedef struct TerrainSnapshot
+{
+	unsigned long long epoch;
+	int meshSize;                     // quads per side; the grid has meshSize + 1 samples per side
+	float originX, originZ;           // world position of sample (0, 0)
+	float stepX, stepZ;               // world distance between neighbouring columns / rows
+	std::vector<float> heights;       // row-major heights
+	std::vector<Vector3D> normals;    // row-major normals
+	std::vector<Metaball> blobs;      // field used for points off the grid
+} TerrainSnapshot;
+
+typedef std::shared_ptr<const TerrainSnapshot> TerrainSnapshotRef;
+
+enum TerrainFilter
+{
+	TERRAIN_BILINEAR,                 // interpolated heights and normals of the 4 nearest samples
+	TERRAIN_BICUBIC                   // Catmull-Rom over 4x4 samples, normals from its gradient
+};
+
+// Editor side: copy the mesh into a new snapshot and make it current. Call from the
+// thread that owns the mesh once it is fully evaluated.
+void PublishTerrainQM(const QuadMesh* qm, const std::vector<Metaball>& blobList);
+
+// Any thread: the current snapshot (empty until the first publication).
+TerrainSnapshotRef AcquireTerrainSnapshot();
+
+// Fills heights[i] (and normals[i] unless normals is NULL) for the points (x[i], z[i]).
+// Bilinear queries go 8 at a time through an AVX2 kernel when the CPU supports it.
+void QueryTerrain(const TerrainSnapshot* snapshot, const float* x, const float* z, int count,
+	TerrainFilter filter, float* heights, Vector3D* normals);
+
+#endif	//TERRAINQUERY_H
@@ -0,0 +1,88 @@
+#include <stddef.h>
+#include "TerrainQueryAVX2.h"
+
+#ifdef TERRAIN_QUERY_AVX2
+#include <immintrin.h>
+
+// MSVC builds this file with /arch:AVX2; GCC and Clang only enable AVX2 for the kernel.
+#if defined(__GNUC__) && !defined(__AVX2__)
+#define AVX2_TARGET __attribute__((target("avx2")))
+#else
+#define AVX2_TARGET
+#endif
+
+// Bilinear queries for 8 points at a time using gathers.
+AVX2_TARGET int QueryBilinear8AVX2(const TerrainGridAVX2* s, const float* x, const float* z, float* heights, float* normals)
+{
+	const int rowLen = s->meshSize + 1;
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 size = _mm256_set1_ps((float)s->meshSize);
+	const __m256i lastCell = _mm256_set1_epi32(s->meshSize - 1);
+	const __m256i stride = _mm256_set1_epi32(rowLen);
+	const float* h = s->heights;
+	const float* n = s->normals;
+
+	__m256 u = _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(x), _mm256_set1_ps(s->originX)), _mm256_set1_ps(s->stepX));
+	__m256 v = _mm256_div_ps(_mm256_sub_ps(_mm256_loadu_ps(z), _mm256_set1_ps(s->originZ)), _mm256_set1_ps(s->stepZ));
+	__m256 inside = _mm256_and_ps(
+		_mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, size, _CMP_LE_OQ)),
+		_mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(v, size, _CMP_LE_OQ)));
+	// Off-grid lanes are pointed at cell (0, 0) so every gather stays in bounds
+	u = _mm256_and_ps(inside, u);
+	v = _mm256_and_ps(inside, v);
+
+	__m256i i = _mm256_min_epi32(_mm256_cvttps_epi32(u), lastCell);
+	__m256i j = _mm256_min_epi32(_mm256_cvttps_epi32(v), lastCell);
+	__m256 fu = _mm256_sub_ps(u, _mm256_cvtepi32_ps(i));
+	__m256 fv = _mm256_sub_ps(v, _mm256_cvtepi32_ps(j));
+	__m256 gu = _mm256_sub_ps(one, fu);
+	__m256 gv = _mm256_sub_ps(one, fv);
+	__m256 w00 = _mm256_mul_ps(gu, gv), w01 = _mm256_mul_ps(fu, gv);
+	__m256 w10 = _mm256_mul_ps(gu, fv), w11 = _mm256_mul_ps(fu, fv);
+
+	__m256i k00 = _mm256_add_epi32(_mm256_mullo_epi32(j, stride), i);
+	__m256i k01 = _mm256_add_epi32(k00, _mm256_set1_epi32(1));
+	__m256i k10 = _mm256_add_epi32(k00, stride);
+	__m256i k11 = _mm256_add_epi32(k10, _mm256_set1_epi32(1));
+
+	__m256 height = _mm256_mul_ps(w00, _mm256_i32gather_ps(h, k00, 4));
+	height = _mm256_add_ps(height, _mm256_mul_ps(w01, _mm256_i32gather_ps(h, k01, 4)));
+	height = _mm256_add_ps(height, _mm256_mul_ps(w10, _mm256_i32gather_ps(h, k10, 4)));
+	height = _mm256_add_ps(height, _mm256_mul_ps(w11, _mm256_i32gather_ps(h, k11, 4)));
+	_mm256_storeu_ps(heights, height);
+
+	if (normals != NULL)
+	{
+		// Normals are 3 floats apart, so gather x, y and z with scaled indices
+		const __m256i three = _mm256_set1_epi32(3);
+		__m256i n00 = _mm256_mullo_epi32(k00, three), n01 = _mm256_mullo_epi32(k01, three);
+		__m256i n10 = _mm256_mullo_epi32(k10, three), n11 = _mm256_mullo_epi32(k11, three);
+		__m256 comp[3];
+		for (int c = 0; c < 3; c++)
+		{
+			const float* base = n + c;
+			__m256 sum = _mm256_mul_ps(w00, _mm256_i32gather_ps(base, n00, 4));
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(w01, _mm256_i32gather_ps(base, n01, 4)));
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(w10, _mm256_i32gather_ps(base, n10, 4)));
+			comp[c] = _mm256_add_ps(sum, _mm256_mul_ps(w11, _mm256_i32gather_ps(base, n11, 4)));
+		}
+		__m256 len2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(comp[0], comp[0]), _mm256_mul_ps(comp[1], comp[1])), _mm256_mul_ps(comp[2], comp[2]));
+		__m256 valid = _mm256_cmp_ps(len2, zero, _CMP_GT_OQ);
+		__m256 inv = _mm256_blendv_ps(one, _mm256_div_ps(one, _mm256_sqrt_ps(len2)), valid);
+		float nx[8], ny[8], nz[8];
+		_mm256_storeu_ps(nx, _mm256_mul_ps(comp[0], inv));
+		_mm256_storeu_ps(ny, _mm256_mul_ps(comp[1], inv));
+		_mm256_storeu_ps(nz, _mm256_mul_ps(comp[2], inv));
+		for (int l = 0; l < 8; l++)
+		{
+			normals[3 * l] = nx[l];
+			normals[3 * l + 1] = ny[l];
+			normals[3 * l + 2] = nz[l];
+		}
+	}
+
+	return ~_mm256_movemask_ps(inside) & 0xFF;
+}
+
+#endif
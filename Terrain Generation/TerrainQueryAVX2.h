@@ -0,0 +1,27 @@
+#ifndef TERRAINQUERYAVX2_H
+#define TERRAINQUERYAVX2_H
+
+// AVX2 kernel behind QueryTerrain. It lives in its own file because that file is the only
+// one compiled for AVX2 (per-file /arch:AVX2 in the projects, a target attribute with
+// GCC and Clang); QueryTerrain only calls it after checking the CPU supports AVX2.
+// Other architectures have no kernel.
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define TERRAIN_QUERY_AVX2
+#endif
+
+typedef struct TerrainGridAVX2
+{
+	int meshSize;
+	float originX, originZ;
+	float stepX, stepZ;
+	const float* heights;          // row-major
+	const float* normals;          // row-major, 3 floats per sample
+} TerrainGridAVX2;
+
+// Bilinear heights (and normals, 3 floats per point, unless normals is NULL) for the 8
+// points (x[l], z[l]). Returns a mask with bit l set for the points off the grid, whose
+// results are left for the caller to fill.
+int QueryBilinear8AVX2(const TerrainGridAVX2* grid, const float* x, const float* z, float* heights, float* normals);
+
+#endif	//TERRAINQUERYAVX2_H
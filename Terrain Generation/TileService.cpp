@@ -0,0 +1,649 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <chrono>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#endif
+
+#include "TileService.h"
+
+void DefaultTileServiceOptions(TileServiceOptions* options)
+{
+	options->workers = 4;
+	options->tileSize = 128;
+	options->cullTolerance = 1e-6;
+	options->maxAttempts = 3;
+	options->tileTimeoutMs = 30000;
+	options->failRate = 0;
+}
+
+#ifndef _WIN32
+
+static const uint32_t tileMagic = 0x454C4954;    // "TILE"
+static const int pollIntervalMs = 20;
+
+// Wire format, in native byte order since both ends are the same binary:
+//	request:  TileRequest, float x[cols], float z[rows], TileBlob[blobs]
+//	reply:    TileReply, float height[rows * cols] (row-major)
+typedef struct TileRequest
+{
+	uint32_t magic;
+	uint32_t tile;
+	int32_t cols, rows;
+	uint32_t blobs;
+} TileRequest;
+
+typedef struct TileBlob
+{
+	double width, height;        // kept as doubles so workers sum exactly what UpdateMesh would
+	float x, y, z;
+	float unused;
+} TileBlob;
+
+typedef struct TileReply
+{
+	uint32_t magic;
+	uint32_t tile;
+	int32_t count;
+} TileReply;
+
+typedef struct TileRect
+{
+	int c0, r0;
+	int cols, rows;
+} TileRect;
+
+static double NowSeconds()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool WriteAll(int fd, const void* data, size_t bytes)
+{
+	const char* p = (const char*)data;
+	while (bytes > 0)
+	{
+		// MSG_NOSIGNAL: a dead worker is a failed send, not a SIGPIPE
+		ssize_t n = send(fd, p, bytes, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		bytes -= (size_t)n;
+	}
+	return true;
+}
+
+static bool ReadAll(int fd, void* data, size_t bytes)
+{
+	char* p = (char*)data;
+	while (bytes > 0)
+	{
+		ssize_t n = recv(fd, p, bytes, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		bytes -= (size_t)n;
+	}
+	return true;
+}
+
+// Like ReadAll, but gives up once 'deadline' (NowSeconds time) has passed, so a worker
+// that stops in the middle of a reply cannot stall the coordinator.
+static bool ReadAllBefore(int fd, void* data, size_t bytes, double deadline)
+{
+	char* p = (char*)data;
+	while (bytes > 0)
+	{
+		ssize_t n = recv(fd, p, bytes, MSG_DONTWAIT);
+		if (n > 0)
+		{
+			p += n;
+			bytes -= (size_t)n;
+			continue;
+		}
+		if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+			return false;
+
+		int waitMs = (int)ceil((deadline - NowSeconds()) * 1e3);
+		if (waitMs <= 0)
+			return false;
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		if (poll(&pfd, 1, waitMs) == 0)
+			return false;
+	}
+	return true;
+}
+
+// Worker process: answer tile requests until the coordinator closes its end.
+static void RunWorker(int fd, double failRate)
+{
+	srand((unsigned)getpid());
+	std::vector<float> xs, zs, heights;
+	std::vector<TileBlob> wire;
+	std::vector<Metaball> blobs;
+	TileRequest request;
+
+	while (ReadAll(fd, &request, sizeof(request)) && request.magic == tileMagic && request.cols > 0 && request.rows > 0)
+	{
+		xs.resize(request.cols);
+		zs.resize(request.rows);
+		wire.resize(request.blobs);
+		if (!ReadAll(fd, xs.data(), xs.size() * sizeof(float)) || !ReadAll(fd, zs.data(), zs.size() * sizeof(float))
+			|| !ReadAll(fd, wire.data(), wire.size() * sizeof(TileBlob)))
+			break;
+		if (failRate > 0 && rand() < failRate * RAND_MAX)
+			_exit(3);
+
+		blobs.resize(wire.size());
+		for (size_t k = 0; k < wire.size(); k++)
+		{
+			blobs[k].pos = NewVector3D(wire[k].x, wire[k].y, wire[k].z);
+			blobs[k].width = wire[k].width;
+			blobs[k].height = wire[k].height;
+		}
+
+		heights.resize((size_t)request.cols * request.rows);
+		for (int r = 0; r < request.rows; r++)
+			for (int c = 0; c < request.cols; c++)
+				heights[(size_t)r * request.cols + c] = EvaluateHeightQM(blobs, xs[c], zs[r]);
+
+		TileReply reply = { tileMagic, request.tile, (int32_t)heights.size() };
+		if (!WriteAll(fd, &reply, sizeof(reply)) || !WriteAll(fd, heights.data(), heights.size() * sizeof(float)))
+			break;
+	}
+	close(fd);
+	_exit(0);
+}
+
+// Spawner answers: the worker pid, or -1, with the coordinator end of the worker's
+// socket pair attached as SCM_RIGHTS.
+static bool SendWorker(int fd, int32_t pid, int workerFd)
+{
+	union
+	{
+		struct cmsghdr align;
+		char data[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct iovec iov = { &pid, sizeof(pid) };
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (workerFd >= 0)
+	{
+		msg.msg_control = control.data;
+		msg.msg_controllen = sizeof(control.data);
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &workerFd, sizeof(int));
+	}
+
+	ssize_t n;
+	do
+		n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+	while (n < 0 && errno == EINTR);
+	return n == (ssize_t)sizeof(pid);
+}
+
+static bool ReceiveWorker(int fd, int32_t* pid, int* workerFd)
+{
+	union
+	{
+		struct cmsghdr align;
+		char data[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct iovec iov = { pid, sizeof(*pid) };
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.data;
+	msg.msg_controllen = sizeof(control.data);
+
+	ssize_t n;
+	do
+		n = recvmsg(fd, &msg, 0);
+	while (n < 0 && errno == EINTR);
+	*workerFd = -1;
+	struct cmsghdr* cmsg = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+	if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+		memcpy(workerFd, CMSG_DATA(cmsg), sizeof(int));
+	return n == (ssize_t)sizeof(*pid) && *pid > 0 && *workerFd >= 0;
+}
+
+// Spawner process. Each request is an int32: 0 forks a worker and answers with
+// SendWorker, a pid kills that worker. It is started before the coordinator has threads
+// and stays single-threaded, so forking here is always safe, while forking the
+// coordinator later could copy locks held by its other threads. Only the spawner, as the
+// workers' parent, signals and reaps them: a worker it has not reaped yet keeps its pid,
+// so a kill can never reach an unrelated process.
+static void RunSpawner(int fd, double failRate)
+{
+	std::vector<pid_t> children;
+	int32_t request;
+	while (ReadAll(fd, &request, sizeof(request)))
+	{
+		// Reap workers that exited on their own
+		for (size_t i = 0; i < children.size();)
+		{
+			if (waitpid(children[i], NULL, WNOHANG) == children[i])
+			{
+				children[i] = children.back();
+				children.pop_back();
+			}
+			else
+				i++;
+		}
+
+		if (request > 0)
+		{
+			for (size_t i = 0; i < children.size(); i++)
+			{
+				if (children[i] == (pid_t)request)
+				{
+					kill(children[i], SIGKILL);
+					waitpid(children[i], NULL, 0);
+					children[i] = children.back();
+					children.pop_back();
+					break;
+				}
+			}
+			continue;
+		}
+
+		int sv[2];
+		int32_t pid = -1;
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0)
+		{
+			pid = (int32_t)fork();
+			if (pid == 0)
+			{
+				close(fd);
+				close(sv[0]);
+				RunWorker(sv[1], failRate);
+			}
+			close(sv[1]);
+			if (pid < 0)
+				close(sv[0]);
+		}
+		if (pid > 0)
+			children.push_back((pid_t)pid);
+		bool sent = SendWorker(fd, pid, pid > 0 ? sv[0] : -1);
+		if (pid > 0)
+			close(sv[0]);
+		if (!sent)
+			break;
+	}
+	close(fd);
+
+	// Outlive the workers, so StopTileService only has to wait for this process
+	for (size_t i = 0; i < children.size(); i++)
+		waitpid(children[i], NULL, 0);
+	_exit(0);
+}
+
+static bool SpawnWorker(TileService* service, int w)
+{
+	const int32_t request = 0;
+	int32_t pid;
+	int fd = -1;
+	if (!WriteAll(service->spawnerFd, &request, sizeof(request)) || !ReceiveWorker(service->spawnerFd, &pid, &fd))
+	{
+		if (fd >= 0)
+			close(fd);
+		return false;
+	}
+
+	TileWorker& worker = service->workers[w];
+	worker.pid = (int)pid;
+	worker.fd = fd;
+	worker.tile = -1;
+	worker.started = 0;
+	return true;
+}
+
+// A worker that exited closes its end of the socket pair.
+static bool WorkerExited(const TileWorker* worker)
+{
+	struct pollfd pfd = { worker->fd, POLLIN, 0 };
+	return poll(&pfd, 1, 0) == 1 && (pfd.revents & (POLLHUP | POLLERR)) != 0;
+}
+
+// Drop a worker, asking the spawner to kill it unless it already exited.
+static void KillWorker(TileService* service, TileWorker* worker)
+{
+	if (worker->pid > 0 && !WorkerExited(worker))
+	{
+		const int32_t request = (int32_t)worker->pid;
+		WriteAll(service->spawnerFd, &request, sizeof(request));
+	}
+	if (worker->fd >= 0)
+		close(worker->fd);
+	worker->pid = 0;
+	worker->fd = -1;
+	worker->tile = -1;
+}
+
+bool StartTileService(TileService* service, const TileServiceOptions* options)
+{
+	service->options = *options;
+	if (service->options.workers < 1)
+		service->options.workers = 1;
+	if (service->options.tileSize < 2)
+		service->options.tileSize = 2;
+	if (service->options.maxAttempts < 1)
+		service->options.maxAttempts = 1;
+
+	TileWorker idle = { 0, -1, -1, 0 };
+	service->workers.assign(service->options.workers, idle);
+	service->spawnerPid = 0;
+	service->spawnerFd = -1;
+
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+		return false;
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		close(sv[0]);
+		RunSpawner(sv[1], service->options.failRate);
+	}
+	close(sv[1]);
+	if (pid < 0)
+	{
+		close(sv[0]);
+		return false;
+	}
+	service->spawnerPid = (int)pid;
+	service->spawnerFd = sv[0];
+
+	for (int w = 0; w < service->options.workers; w++)
+	{
+		if (!SpawnWorker(service, w))
+		{
+			StopTileService(service);
+			return false;
+		}
+	}
+	return true;
+}
+
+void StopTileService(TileService* service)
+{
+	// Closing the sockets lets idle workers and then the spawner exit on their own
+	for (size_t w = 0; w < service->workers.size(); w++)
+	{
+		TileWorker& worker = service->workers[w];
+		if (worker.fd >= 0)
+			close(worker.fd);
+		worker.fd = -1;
+		worker.pid = 0;
+	}
+	if (service->spawnerFd >= 0)
+		close(service->spawnerFd);
+	if (service->spawnerPid > 0)
+		waitpid((pid_t)service->spawnerPid, NULL, 0);
+	service->spawnerFd = -1;
+	service->spawnerPid = 0;
+	service->workers.clear();
+}
+
+// Metaballs that add more than the tolerance somewhere in the box [x0, x1] x [z0, z1].
+static void CullBlobs(const std::vector<Metaball>& blobList, float x0, float x1, float z0, float z1,
+	double tolerance, std::vector<TileBlob>* subset)
+{
+	subset->clear();
+	for (size_t k = 0; k < blobList.size(); k++)
+	{
+		const Metaball& b = blobList[k];
+		double dx = b.pos.x < x0 ? x0 - b.pos.x : (b.pos.x > x1 ? b.pos.x - x1 : 0);
+		double dz = b.pos.z < z0 ? z0 - b.pos.z : (b.pos.z > z1 ? b.pos.z - z1 : 0);
+		double d2 = dx * dx + (double)b.pos.y * b.pos.y + dz * dz;
+		if (b.width > 0 && fabs(b.height) * exp(-b.width * d2) <= tolerance)
+			continue;
+
+		TileBlob blob = { b.width, b.height, b.pos.x, b.pos.y, b.pos.z, 0 };
+		subset->push_back(blob);
+	}
+}
+
+typedef struct TileJob
+{
+	const std::vector<Metaball>* blobList;
+	std::vector<TileRect> tiles;
+	std::vector<float> xs, zs;           // x of every column, z of every row
+	std::deque<int> pending;
+	std::vector<int> failures;           // per tile
+	int remaining;
+	bool failed;
+	TileServiceReport* report;
+
+	std::vector<char> message;           // scratch buffers
+	std::vector<TileBlob> subset;
+	std::vector<float> heights;
+} TileJob;
+
+static bool SendTile(TileService* service, TileWorker* worker, TileJob* job, int t)
+{
+	const TileRect& tile = job->tiles[t];
+	const float* xs = &job->xs[tile.c0];
+	const float* zs = &job->zs[tile.r0];
+	float x0 = xs[0], x1 = xs[tile.cols - 1], z0 = zs[0], z1 = zs[tile.rows - 1];
+	CullBlobs(*job->blobList, x0 < x1 ? x0 : x1, x0 < x1 ? x1 : x0, z0 < z1 ? z0 : z1, z0 < z1 ? z1 : z0,
+		service->options.cullTolerance, &job->subset);
+
+	TileRequest request = { tileMagic, (uint32_t)t, tile.cols, tile.rows, (uint32_t)job->subset.size() };
+	const size_t bytes = sizeof(request) + (tile.cols + tile.rows) * sizeof(float) + job->subset.size() * sizeof(TileBlob);
+	job->message.resize(bytes);
+	char* p = job->message.data();
+	memcpy(p, &request, sizeof(request));
+	p += sizeof(request);
+	memcpy(p, xs, tile.cols * sizeof(float));
+	p += tile.cols * sizeof(float);
+	memcpy(p, zs, tile.rows * sizeof(float));
+	p += tile.rows * sizeof(float);
+	if (!job->subset.empty())
+		memcpy(p, job->subset.data(), job->subset.size() * sizeof(TileBlob));
+
+	worker->tile = t;
+	worker->started = NowSeconds();
+	job->report->blobsSent += (long long)job->subset.size();
+	job->report->bytesSent += (long long)bytes;
+	return WriteAll(worker->fd, job->message.data(), bytes);
+}
+
+// The whole reply must arrive within the tile's timeout, even once it has started.
+static bool ReceiveTile(TileService* service, TileWorker* worker, TileJob* job, QuadMesh* qm)
+{
+	const TileRect& tile = job->tiles[worker->tile];
+	const double deadline = worker->started + service->options.tileTimeoutMs * 1e-3;
+	TileReply reply;
+	if (!ReadAllBefore(worker->fd, &reply, sizeof(reply), deadline) || reply.magic != tileMagic
+		|| reply.tile != (uint32_t)worker->tile || reply.count != tile.cols * tile.rows)
+		return false;
+	job->heights.resize(reply.count);
+	if (!ReadAllBefore(worker->fd, job->heights.data(), reply.count * sizeof(float), deadline))
+		return false;
+	job->report->bytesReceived += (long long)(sizeof(reply) + reply.count * sizeof(float));
+
+	const int rowLen = qm->meshSize + 1;
+	for (int r = 0; r < tile.rows; r++)
+		for (int c = 0; c < tile.cols; c++)
+			qm->vertices[(tile.r0 + r) * rowLen + tile.c0 + c].position.y = job->heights[r * tile.cols + c];
+	worker->tile = -1;
+	return true;
+}
+
+// Replace a worker that crashed, hung or misbehaved, and queue its tile again.
+static void FailWorker(TileService* service, int w, TileJob* job)
+{
+	TileWorker& worker = service->workers[w];
+	int t = worker.tile;
+	KillWorker(service, &worker);
+	job->report->workerFailures++;
+	if (t >= 0)
+	{
+		if (++job->failures[t] >= service->options.maxAttempts)
+			job->failed = true;
+		else
+		{
+			job->pending.push_front(t);
+			job->report->retries++;
+		}
+	}
+	SpawnWorker(service, w);
+}
+
+bool GenerateTilesQM(TileService* service, QuadMesh* qm, const std::vector<Metaball>& blobList, TileServiceReport* report)
+{
+	TileServiceReport unused;
+	TileJob job;
+	job.report = report != NULL ? report : &unused;
+	memset(job.report, 0, sizeof(TileServiceReport));
+	double start = NowSeconds();
+
+	const int last = qm->meshSize;
+	const int rowLen = last + 1;
+	const int size = service->options.tileSize;
+	if (last < 1 || service->workers.empty())
+		return false;
+
+	job.blobList = &blobList;
+	job.xs.resize(rowLen);
+	job.zs.resize(rowLen);
+	for (int i = 0; i < rowLen; i++)
+	{
+		job.xs[i] = qm->vertices[i].position.x;
+		job.zs[i] = qm->vertices[i * rowLen].position.z;
+	}
+	for (int r0 = 0; r0 < rowLen; r0 += size)
+	{
+		for (int c0 = 0; c0 < rowLen; c0 += size)
+		{
+			TileRect tile = { c0, r0, c0 + size < rowLen ? size : rowLen - c0, r0 + size < rowLen ? size : rowLen - r0 };
+			job.pending.push_back((int)job.tiles.size());
+			job.tiles.push_back(tile);
+		}
+	}
+	job.failures.assign(job.tiles.size(), 0);
+	job.remaining = (int)job.tiles.size();
+	job.failed = false;
+	job.report->tiles = job.remaining;
+
+	std::vector<struct pollfd> fds;
+	std::vector<int> polled;
+	while (!job.failed && job.remaining > 0)
+	{
+		// Keep every live worker busy
+		bool alive = false;
+		for (int w = 0; w < (int)service->workers.size(); w++)
+		{
+			TileWorker& worker = service->workers[w];
+			if (worker.pid > 0 && worker.tile < 0 && !job.pending.empty())
+			{
+				int t = job.pending.front();
+				job.pending.pop_front();
+				if (!SendTile(service, &worker, &job, t))
+					FailWorker(service, w, &job);
+			}
+			alive = alive || worker.pid > 0;
+		}
+		if (!alive)
+		{
+			job.failed = true;
+			break;
+		}
+
+		fds.clear();
+		polled.clear();
+		for (int w = 0; w < (int)service->workers.size(); w++)
+		{
+			if (service->workers[w].tile < 0)
+				continue;
+			struct pollfd pfd = { service->workers[w].fd, POLLIN, 0 };
+			fds.push_back(pfd);
+			polled.push_back(w);
+		}
+		if (poll(fds.data(), fds.size(), pollIntervalMs) < 0 && errno != EINTR)
+		{
+			job.failed = true;
+			break;
+		}
+
+		// A hang-up still shows up as readable and then fails to read a reply
+		double now = NowSeconds();
+		for (size_t i = 0; i < fds.size(); i++)
+		{
+			const int w = polled[i];
+			TileWorker& worker = service->workers[w];
+			if (fds[i].revents != 0)
+			{
+				if (ReceiveTile(service, &worker, &job, qm))
+					job.remaining--;
+				else
+					FailWorker(service, w, &job);
+			}
+			else if ((now - worker.started) * 1e3 > service->options.tileTimeoutMs)
+			{
+				FailWorker(service, w, &job);
+			}
+		}
+	}
+
+	// Workers still busy with an abandoned mesh would answer the next one
+	for (int w = 0; w < (int)service->workers.size(); w++)
+	{
+		if (service->workers[w].tile >= 0)
+		{
+			KillWorker(service, &service->workers[w]);
+			SpawnWorker(service, w);
+		}
+	}
+
+	if (!job.failed)
+	{
+		qm->refineStride = 0;
+		ComputeNormalsQM(qm);
+	}
+	job.report->seconds = NowSeconds() - start;
+	return !job.failed;
+}
+
+#else
+
+bool StartTileService(TileService* service, const TileServiceOptions* options)
+{
+	service->options = *options;
+	service->workers.clear();
+	service->spawnerPid = 0;
+	service->spawnerFd = -1;
+	return false;
+}
+
+bool GenerateTilesQM(TileService* service, QuadMesh* qm, const std::vector<Metaball>& blobList, TileServiceReport* report)
+{
+	return false;
+}
+
+void StopTileService(TileService* service)
+{
+	service->workers.clear();
+}
+
+#endif
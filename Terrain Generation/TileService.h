@@ -0,0 +1,69 @@
+#ifndef TILESERVICE_H
+#define TILESERVICE_H
+
+#include <vector>
+#include "QuadMesh.h"
+
+// Multi-process terrain generation on one machine.
+//
+// A coordinator forks worker processes, each connected through a Unix domain socket pair.
+// The grid of a mesh is split into square tiles of vertices; every tile is sent to an idle
+// worker together with the x and z of its columns and rows and only the metaballs that
+// contribute more than 'cullTolerance' to it. Workers answer with the tile's heights,
+// which are stitched back into the QuadMesh. Normals are computed over the stitched mesh,
+// so they are continuous across tile borders.
+//
+// A worker that dies, sends a malformed reply or takes longer than 'tileTimeoutMs' is
+// killed and replaced, and its tile goes back to the queue; a tile that fails
+// 'maxAttempts' times fails the mesh. 'failRate' makes workers crash on purpose on that
+// fraction of tiles to exercise this path.
+//
+// Workers, replacements included, are forked by a spawner process that StartTileService
+// forks first, so it must be called before the caller starts any threads.
+//
+// Linux only (fork and AF_UNIX sockets); elsewhere StartTileService fails.
+
+typedef struct TileServiceOptions
+{
+	int workers;
+	int tileSize;                // vertices per tile side
+	double cullTolerance;        // largest height a left-out metaball may add to a tile
+	int maxAttempts;
+	double tileTimeoutMs;
+	double failRate;             // probability a worker crashes on a tile, for testing
+} TileServiceOptions;
+
+typedef struct TileServiceReport
+{
+	int tiles;
+	int retries;                 // tiles sent again after a worker failed
+	int workerFailures;
+	long long blobsSent;         // metaballs over all tile requests
+	long long bytesSent;
+	long long bytesReceived;
+	double seconds;
+} TileServiceReport;
+
+typedef struct TileWorker
+{
+	int pid;                     // 0 when the slot has no process
+	int fd;                      // coordinator end of the socket pair
+	int tile;                    // tile being generated, -1 when idle
+	double started;              // when the tile was sent, in seconds
+} TileWorker;
+
+typedef struct TileService
+{
+	TileServiceOptions options;
+	std::vector<TileWorker> workers;
+	int spawnerPid;              // single-threaded process that forks the workers
+	int spawnerFd;               // coordinator end of the socket pair to the spawner
+} TileService;
+
+void DefaultTileServiceOptions(TileServiceOptions* options);
+bool StartTileService(TileService* service, const TileServiceOptions* options);
+// Fills the heights and normals of a mesh set up by InitMeshQM.
+bool GenerateTilesQM(TileService* service, QuadMesh* qm, const std::vector<Metaball>& blobList, TileServiceReport* report);
+void StopTileService(TileService* service);
+
+#endif	//TILESERVICE_H
@@ -15,6 +15,9 @@
 
 #ifndef VECTOR3D_H
 #define VECTOR3D_H
+
+#include <math.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -25,20 +28,79 @@ typedef struct Vector3D {
 	float z;
 } Vector3D;
 
-Vector3D NewVector3D(float x, float y, float z);
-void Set(Vector3D* v, float newX, float newY, float newZ);
-void LoadZero(Vector3D* v);
-void LoadOne(Vector3D* v);
+// All operations are defined inline so the mesh loops do not pay for a call per vector.
+
+static inline void Set(Vector3D* v, float newX, float newY, float newZ)
+{
+	v->x = newX;  v->y = newY;  v->z = newZ;
+}
+
+static inline Vector3D NewVector3D(float x, float y, float z)
+{
+	Vector3D v;
+	Set(&v, x, y, z);
+	return v;
+}
+
+static inline void LoadZero(Vector3D* v)
+{
+	v->x = v->y = v->z = 0;
+}
+
+static inline void LoadOne(Vector3D* v)
+{
+	v->x = v->y = v->z = 1;
+}
+	
+// Vector algebra
+
+// Calculates lhs = lhs X rhs
+static inline void CrossProduct(const Vector3D* lhs, const Vector3D* rhs, Vector3D* result)
+{
+	Set(result, lhs->y*rhs->z - lhs->z*rhs->y, lhs->z*rhs->x - lhs->x*rhs->z, lhs->x*rhs->y - lhs->y*rhs->x);
+}
+
+// Calculates and returns lhs . rhs
+static inline float DotProduct(const Vector3D* lhs, const Vector3D* rhs)
+{	return lhs->x*rhs->x + lhs->y*rhs->y + lhs->z*rhs->z;	}
+
+// Returns the vector length (magnitude).
+static inline float GetLength(const Vector3D* lhs)
+{	
+	return sqrtf(lhs->x*lhs->x + lhs->y*lhs->y + lhs->z*lhs->z);
+}
+
+// Normalizes 'lhs' (if possible).
+static inline void Normalize(Vector3D* lhs)
+{
+	const float norm = GetLength(lhs);
+	if (norm > 0)
+	{
+		const float inv = 1.0f / norm;
+		lhs->x *= inv; lhs->y *= inv; lhs->z *= inv;
+	}
+}
+
+//Add, subtract etc.
+static inline void Add(const Vector3D* v1, const Vector3D* v2, Vector3D* result)
+{
+	Set(result, v1->x + v2->x, v1->y + v2->y, v1->z + v2->z);
+}
+
+static inline void Subtract(const Vector3D* v1, const Vector3D* v2, Vector3D* result)
+{
+	Set(result, v1->x - v2->x, v1->y - v2->y, v1->z - v2->z);
+}
 
-void CrossProduct(const Vector3D* lhs, const Vector3D* rhs, Vector3D* result);
-float DotProduct(const Vector3D* lhs, const Vector3D* rhs);
-void Normalize(Vector3D* lhs);
-float GetLength(Vector3D* lhs);
+static inline void ScalarMul(const Vector3D* v, const float rhs, Vector3D* result)
+{
+	Set(result, v->x * rhs, v->y * rhs, v->z * rhs);
+}
 
-void Add(const Vector3D* v1, const Vector3D* v2, Vector3D* result);
-void Subtract(const Vector3D* v1, const Vector3D* v2, Vector3D* result);
-void ScalarMul(const Vector3D* v, const float rhs, Vector3D* result);
-void Negate(const Vector3D* v, Vector3D* result);
+static inline void Negate(const Vector3D* v, Vector3D* result)
+{
+	Set(result, -v->x, -v->y, -v->z);
+}
 
 #ifdef __cplusplus
 	}
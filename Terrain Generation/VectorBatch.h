@@ -0,0 +1,115 @@
+//////////////////////////////////////////////////////////////////////////////////////////
+//	Batched 3D vector operations over arrays of Vector3D.
+//
+//	Each function applies the matching Vector3D.h operation to n elements. With SSE2
+//	available (always on x64) four vectors are processed at a time: they are loaded as
+//	three registers, transposed to x/y/z lanes, computed and transposed back. Results are
+//	bit-identical to the scalar functions. Define VECTOR_BATCH_SCALAR to force the
+//	scalar path.
+//////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef VECTORBATCH_H
+#define VECTORBATCH_H
+
+#include "Vector3D.h"
+
+#if !defined(VECTOR_BATCH_SCALAR) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define VECTOR_BATCH_SSE 1
+#include <emmintrin.h>
+#endif
+
+#ifdef VECTOR_BATCH_SSE
+
+// Loads v[0..3] and splits them into x, y and z lanes.
+static inline void LoadSoA4(const Vector3D* v, __m128* x, __m128* y, __m128* z)
+{
+	const float* f = &v->x;
+	__m128 m0 = _mm_loadu_ps(f);        // x0 y0 z0 x1
+	__m128 m1 = _mm_loadu_ps(f + 4);    // y1 z1 x2 y2
+	__m128 m2 = _mm_loadu_ps(f + 8);    // z2 x3 y3 z3
+	__m128 t = _mm_shuffle_ps(m1, m2, _MM_SHUFFLE(2, 1, 3, 2));    // x2 y2 x3 y3
+	__m128 u = _mm_shuffle_ps(m0, m1, _MM_SHUFFLE(1, 0, 2, 1));    // y0 z0 y1 z1
+	*x = _mm_shuffle_ps(m0, t, _MM_SHUFFLE(2, 0, 3, 0));
+	*y = _mm_shuffle_ps(u, t, _MM_SHUFFLE(3, 1, 2, 0));
+	*z = _mm_shuffle_ps(u, m2, _MM_SHUFFLE(3, 0, 3, 1));
+}
+
+// Inverse of LoadSoA4.
+static inline void StoreSoA4(Vector3D* v, __m128 x, __m128 y, __m128 z)
+{
+	float* f = &v->x;
+	__m128 xyLo = _mm_unpacklo_ps(x, y);                             // x0 y0 x1 y1
+	__m128 xyHi = _mm_unpackhi_ps(x, y);                             // x2 y2 x3 y3
+	__m128 zx = _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0));       // z0 z0 x1 x1
+	__m128 yz = _mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1));       // y1 y1 z1 z1
+	__m128 zxy = _mm_shuffle_ps(z, xyHi, _MM_SHUFFLE(3, 2, 3, 2));   // z2 z3 x3 y3
+	_mm_storeu_ps(f, _mm_shuffle_ps(xyLo, zx, _MM_SHUFFLE(2, 0, 1, 0)));
+	_mm_storeu_ps(f + 4, _mm_shuffle_ps(yz, xyHi, _MM_SHUFFLE(1, 0, 2, 0)));
+	_mm_storeu_ps(f + 8, _mm_shuffle_ps(zxy, zxy, _MM_SHUFFLE(1, 3, 2, 0)));
+}
+
+#endif
+
+// result[i] = v1[i] - v2[i]
+static inline void SubtractN(const Vector3D* v1, const Vector3D* v2, Vector3D* result, int n)
+{
+	int i = 0;
+#ifdef VECTOR_BATCH_SSE
+	// Component-wise, so no transpose is needed
+	for (; i + 4 <= n; i += 4)
+	{
+		const float* a = &v1[i].x;
+		const float* b = &v2[i].x;
+		float* r = &result[i].x;
+		_mm_storeu_ps(r, _mm_sub_ps(_mm_loadu_ps(a), _mm_loadu_ps(b)));
+		_mm_storeu_ps(r + 4, _mm_sub_ps(_mm_loadu_ps(a + 4), _mm_loadu_ps(b + 4)));
+		_mm_storeu_ps(r + 8, _mm_sub_ps(_mm_loadu_ps(a + 8), _mm_loadu_ps(b + 8)));
+	}
+#endif
+	for (; i < n; i++)
+		Subtract(&v1[i], &v2[i], &result[i]);
+}
+
+// result[i] = lhs[i] X rhs[i]
+static inline void CrossProductN(const Vector3D* lhs, const Vector3D* rhs, Vector3D* result, int n)
+{
+	int i = 0;
+#ifdef VECTOR_BATCH_SSE
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 ax, ay, az, bx, by, bz;
+		LoadSoA4(&lhs[i], &ax, &ay, &az);
+		LoadSoA4(&rhs[i], &bx, &by, &bz);
+		StoreSoA4(&result[i],
+			_mm_sub_ps(_mm_mul_ps(ay, bz), _mm_mul_ps(az, by)),
+			_mm_sub_ps(_mm_mul_ps(az, bx), _mm_mul_ps(ax, bz)),
+			_mm_sub_ps(_mm_mul_ps(ax, by), _mm_mul_ps(ay, bx)));
+	}
+#endif
+	for (; i < n; i++)
+		CrossProduct(&lhs[i], &rhs[i], &result[i]);
+}
+
+// Normalizes every v[i] that has a non-zero length.
+static inline void NormalizeN(Vector3D* v, int n)
+{
+	int i = 0;
+#ifdef VECTOR_BATCH_SSE
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 x, y, z;
+		LoadSoA4(&v[i], &x, &y, &z);
+		__m128 norm = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+		// Lanes of length zero keep a scale of one, like Normalize
+		__m128 valid = _mm_cmpgt_ps(norm, zero);
+		__m128 inv = _mm_or_ps(_mm_and_ps(valid, _mm_div_ps(one, norm)), _mm_andnot_ps(valid, one));
+		StoreSoA4(&v[i], _mm_mul_ps(x, inv), _mm_mul_ps(y, inv), _mm_mul_ps(z, inv));
+	}
+#endif
+	for (; i < n; i++)
+		Normalize(&v[i]);
+}
+
+#endif	//VECTORBATCH_H
@@ -1,13 +1,20 @@
 #include <stdio.h>
 #include <iostream>
 #include <math.h>
+#include <string.h>
+#include <stdlib.h>
 #include <vector>
+#include <chrono>
 
 #include <gl/glut.h>
 #include <glm.hpp>
 #include <gtc/type_ptr.hpp>
 
 #include "QuadMesh.h"
+#include "TerrainQuery.h"
+#include "FastGauss.h"
+#include "HorizonOcclusion.h"
+#include "SharedTerrain.h"
 
 #define DEG2RAD 3.14159f/180.0f
 
@@ -24,6 +31,12 @@ void insertBall(glm::vec3);
 void updateBallPos(glm::vec3, int ballIndex);
 void incrementBallSize(float width, float height, int index);
 void removeLastBall();
+void setMeshSize(int size);
+void updateTerrain();
+void shadeTerrain();
+void publishTerrain();
+void shareTerrain();
+void unshareTerrain();
 glm::vec3 rayCast(int x, int y);
 
 int vWidth = 1000;
@@ -31,9 +44,17 @@ int vHeight = 800;
 
 // Terrain
 static QuadMesh terrain;
-const int meshSize = 48; // meshSize x meshSize (quads)
+int meshSize = 48; // meshSize x meshSize (quads), changed at runtime with -/+ or -size N
+const int minMeshSize = 48;
+const int maxMeshSize = 8192;
 const int meshWidth = 32;
 const int meshLength = 32;
+double frameBudgetMs = 8.0; // time spent evaluating the field per frame while editing
+bool fastGauss = false; // evaluate full updates with the Fast Gauss Transform
+const double fastGaussTolerance = 1e-3;
+const char* shareName = NULL; // shared-memory name the terrain is published under, set with -share NAME
+SharedTerrainWriter sharedTerrain;
+MeshRect unshared = { 0, 0, -1, -1 };  // heights changed since the last shareTerrain
 
 static GLfloat light_position[] = { 100.0F, 100.0F, 0.0F, 1.0F };
 static GLfloat light_diffuse[] = { 1.0, 1.0, 1.0, 1.0 };
@@ -49,6 +70,8 @@ int mainWindowID;
 bool mmDown = false;
 bool rmDown = false;
 bool lmDown = false;
+int lastDragMs = 0;      // GLUT_ELAPSED_TIME of the last blob drag event
+const int dragPauseMs = 100; // a held blob counts as stopped after this long without motion
 
 std::vector<Metaball> ballList;
 int ballIndex = 0;
@@ -69,6 +92,18 @@ float cameraRadius = 32.0;
 
 int main(int argc, char** argv) {
 	glutInit(&argc, argv);
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-size") == 0 && i + 1 < argc) {
+			meshSize = atoi(argv[++i]);
+			if (meshSize < minMeshSize) meshSize = minMeshSize;
+			if (meshSize > maxMeshSize) meshSize = maxMeshSize;
+		}
+		if (strcmp(argv[i], "-share") == 0 && i + 1 < argc) {
+			shareName = argv[++i];
+		}
+	}
+
 	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
 	glutInitWindowSize(vWidth, vHeight);
 	glutInitWindowPosition((glutGet(GLUT_SCREEN_WIDTH) - vWidth) / 2, (glutGet(GLUT_SCREEN_HEIGHT) - vHeight) / 2);
@@ -115,6 +150,19 @@ void initOpenGL(int w, int h) {
 	Vector3D dir2v = NewVector3D(0.0f, 0.0f, -1.0f);
 	terrain = NewQuadMesh(meshSize);
 	InitMeshQM(&terrain, meshSize, origin, meshWidth, meshLength, dir1v, dir2v);
+	unshared = FullRectQM(&terrain);
+	shadeTerrain();
+	if (shareName != NULL) {
+		if (CreateSharedTerrain(&sharedTerrain, shareName, meshSize)) {
+			printf("Sharing the terrain as %s\n", shareName);
+			atexit(unshareTerrain);
+		}
+		else {
+			printf("Cannot share the terrain as %s (is another editor sharing it?)\n", shareName);
+			shareName = NULL;
+		}
+	}
+	publishTerrain();
 
 	Vector3D ambient = NewVector3D(0.0f, 0.05f, 0.0f);
 	Vector3D diffuse = NewVector3D(0.4f, 0.8f, 0.4f);
@@ -154,7 +202,7 @@ void displayHandler(void) {
 	glMaterialfv(GL_FRONT, GL_DIFFUSE, surface_diffuse);
 
 	// Draw ground mesh
-	DrawMeshQM(&terrain, meshSize);
+	DrawMeshQM(&terrain, terrain.meshSize);
 
 	// Selector graphic
 	
@@ -179,6 +227,17 @@ void displayHandler(void) {
 }
 
 void idleHandler(void) {
+	// Refine the terrain left coarse by a drag, a slice of the frame budget at a time,
+	// once the button is released or the blob has not moved for dragPauseMs. GLUT idles
+	// many times between motion events, so a single quiet tick is not a pause
+	bool moving = lmDown && glutGet(GLUT_ELAPSED_TIME) - lastDragMs < dragPauseMs;
+	if (terrain.refineStride > 0 && !moving) {
+		if (RefineMeshQM(&terrain, ballList, frameBudgetMs, &unshared)) {
+			shadeTerrain();
+			publishTerrain();
+		}
+		glutPostRedisplay();
+	}
 }
 
 // state:0 == keyDown
@@ -274,7 +333,34 @@ void keyboardInputHandler(unsigned char key, int x, int y) {
 	// reset
 	else if (key == 'r') {
 		ballList.clear();
-		UpdateMesh(&terrain, ballList);
+		updateTerrain();
+	}
+
+	// frame budget for progressive evaluation
+	else if (key == '[') {
+		frameBudgetMs /= 2;
+		if (frameBudgetMs < 1) frameBudgetMs = 1;
+		printf("Frame budget: %.1f ms\n", frameBudgetMs);
+	}
+	else if (key == ']') {
+		frameBudgetMs *= 2;
+		if (frameBudgetMs > 128) frameBudgetMs = 128;
+		printf("Frame budget: %.1f ms\n", frameBudgetMs);
+	}
+
+	// evaluator for full updates
+	else if (key == 'f') {
+		fastGauss = !fastGauss;
+		printf("Evaluator: %s\n", fastGauss ? "Fast Gauss Transform" : "exact");
+		updateTerrain();
+	}
+
+	// mesh resolution
+	else if (key == '-') {
+		setMeshSize(meshSize / 2 < minMeshSize ? minMeshSize : meshSize / 2);
+	}
+	else if (key == '=' || key == '+') {
+		setMeshSize(meshSize * 2 > maxMeshSize ? maxMeshSize : meshSize * 2);
 	}
 	glutPostRedisplay();
 }
@@ -303,6 +389,9 @@ void specialInputHandler(int key, int x, int y) {
 		printf("a/d - Traverse Selectable Blobs\n");
 		printf("u - Undo Last Blob\n");
 		printf("r - Reset Blobs\n");
+		printf("[/] - Halve/Double Frame Budget While Editing\n");
+		printf("-/+ - Halve/Double Mesh Resolution\n");
+		printf("f - Toggle Fast Gauss Transform Evaluator\n");
 		printf("\n");
 		printf("CAMERA CONTROLS\n");
 		printf("Middle Mouse Button - Hold to rotate camera\n");
@@ -320,14 +409,17 @@ void insertBall(glm::vec3 point) {
 	newMetaBall.height = ballHeight;
 	newMetaBall.width = ballWidth;
 	ballList.push_back(newMetaBall);
-	UpdateMesh(&terrain, ballList);
+	updateTerrain();
 	glutPostRedisplay();
 }
 
 void updateBallPos(glm::vec3 point, int index) {
 	ballList[index].pos.x = point.x;
 	ballList[index].pos.z = point.z;
-	UpdateMesh(&terrain, ballList);
+	// Coarse preview while dragging, idleHandler refines it afterwards
+	BeginProgressiveQM(&terrain, ballList, frameBudgetMs, &unshared);
+	lastDragMs = glutGet(GLUT_ELAPSED_TIME);
+	shareTerrain();
 	glutPostRedisplay();
 }
 
@@ -343,14 +435,76 @@ void incrementBallSize(float width, float height, int index) {
 	if (ballList[index].height < -10) ballList[index].height = -10;
 
 
-	UpdateMesh(&terrain, ballList);
+	updateTerrain();
+	glutPostRedisplay();
+}
+
+// Evaluate the terrain at full resolution and publish it to terrain queries.
+void updateTerrain() {
+	if (fastGauss)
+		UpdateMeshFGT(&terrain, ballList, fastGaussTolerance, NULL);
+	else
+		UpdateMesh(&terrain, ballList);
+	unshared = FullRectQM(&terrain);
+	shadeTerrain();
+	publishTerrain();
+}
+
+// Hand the evaluated terrain to query threads and other processes.
+void publishTerrain() {
+	PublishTerrainQM(&terrain, ballList);
+	shareTerrain();
+}
+
+// Other processes also follow the coarse previews, only the changed area is rewritten.
+void shareTerrain() {
+	if (shareName != NULL)
+		PublishSharedTerrainQM(&sharedTerrain, &terrain, &unshared);
+	unshared = EmptyRectQM();
+}
+
+void unshareTerrain() {
+	DestroySharedTerrain(&sharedTerrain);
+}
+
+// Bake ambient occlusion and sun visibility, with the sun in the direction of GL_LIGHT0
+// from the centre of the terrain. Only the area changed since the last call is redone,
+// and it is never called per frame while a blob is being dragged.
+void shadeTerrain() {
+	Vector3D sun = NewVector3D(light_position[0] - meshWidth / 2, light_position[1], light_position[2] + meshLength / 2);
+	UpdateOcclusionQM(&terrain, sun);
+}
+
+void setMeshSize(int size) {
+	if (size == terrain.meshSize) return;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// Buffers come from the mesh memory pool, so switching back to a size is cheap
+	meshSize = size;
+	Vector3D origin = NewVector3D(0.0f, 0.0f, 0.0f);
+	Vector3D dir1v = NewVector3D(1.0f, 0.0f, 0.0f);
+	Vector3D dir2v = NewVector3D(0.0f, 0.0f, -1.0f);
+	if (!ResizeMeshQM(&terrain, meshSize)) {
+		printf("Not enough memory for a %dx%d mesh\n", size, size);
+		meshSize = minMeshSize;
+		ResizeMeshQM(&terrain, meshSize);
+	}
+	InitMeshQM(&terrain, meshSize, origin, meshWidth, meshLength, dir1v, dir2v);
+	unshared = FullRectQM(&terrain);
+
+	// Show a coarse terrain right away and let idleHandler refine it
+	BeginProgressiveQM(&terrain, ballList, frameBudgetMs, &unshared);
+	shareTerrain();
+
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	printf("Mesh resolution: %dx%d (%.1f ms)\n", meshSize, meshSize, ms);
 	glutPostRedisplay();
 }
 
 void removeLastBall() {
 	ballList.pop_back();
 	ballIndex = ballList.size() - 1;
-	UpdateMesh(&terrain, ballList);
+	updateTerrain();
 	glutPostRedisplay();
 }
 